@@ -123,10 +123,19 @@ int main() {
 #if defined(UMF_BUILD_OS_MEMORY_PROVIDER) &&                                   \
     defined(UMF_BUILD_LIBUMF_POOL_DISJOINT)
     auto disjointParams = umfDisjointPoolParamsDefault();
+    disjointParams.SlabMinSize = 64 * 1024;
+    disjointParams.MaxPoolableSize = 2 * 1024 * 1024;
+    disjointParams.Capacity = 4;
 
     std::cout << "disjoint_pool mt_alloc_free: ";
     mt_alloc_free(poolCreateExtParams{umfDisjointPoolOps(), &disjointParams,
                                       umfOsMemoryProviderOps(), &osParams});
+
+    disjointParams.ThreadCacheSize = 256;
+
+    std::cout << "disjoint_pool with thread cache mt_alloc_free: ";
+    mt_alloc_free(poolCreateExtParams{umfDisjointPoolOps(), &disjointParams,
+                                      umfOsMemoryProviderOps(), &osParams});
 #else
     std::cout << "skipping disjoint_pool mt_alloc_free" << std::endl;
 #endif
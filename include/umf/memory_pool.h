@@ -120,6 +120,23 @@ size_t umfPoolMallocUsableSize(umf_memory_pool_handle_t hPool, void *ptr);
 ///
 umf_result_t umfPoolFree(umf_memory_pool_handle_t hPool, void *ptr);
 
+///
+/// @brief Frees the memory space of the specified \p hPool pointed by \p ptr,
+///        allocated with \p size bytes. Pools can use the size to avoid looking
+///        up the allocation, others just free it like umfPoolFree.
+/// @param hPool specified memory hPool
+/// @param ptr pointer to the allocated memory, returned by umfPoolMalloc,
+///        umfPoolCalloc or umfPoolRealloc. Memory from umfPoolAlignedMalloc
+///        has to be freed with umfPoolFree.
+/// @param size size requested when \p ptr was allocated (num * size for
+///        umfPoolCalloc, the new size for umfPoolRealloc)
+/// @return UMF_RESULT_SUCCESS on success or appropriate error code on failure.
+///         Whether any status other than UMF_RESULT_SUCCESS can be returned
+///         depends on the memory provider used by the \p hPool.
+///
+umf_result_t umfPoolFreeSized(umf_memory_pool_handle_t hPool, void *ptr,
+                              size_t size);
+
 ///
 /// @brief Frees the memory space pointed by ptr if it belongs to UMF pool, does nothing otherwise.
 /// @param ptr pointer to the allocated memory
@@ -120,6 +120,19 @@ typedef struct umf_memory_pool_ops_t {
     ///         The value is undefined if the previous allocation was successful.
     ///
     umf_result_t (*get_last_allocation_error)(void *pool);
+
+    ///
+    /// @brief Frees the memory space of the specified \p pool pointed by \p ptr,
+    ///        knowing the size it was allocated with. This function is optional
+    ///        and may be NULL, \p free is used instead then.
+    /// @param pool pointer to the memory pool
+    /// @param ptr pointer to the allocated memory to free
+    /// @param size size requested when \p ptr was allocated, see umfPoolFreeSized
+    /// @return UMF_RESULT_SUCCESS on success or appropriate error code on failure.
+    ///         Whether any status other than UMF_RESULT_SUCCESS can be returned
+    ///         depends on the memory provider used by the \p pool.
+    ///
+    umf_result_t (*free_sized)(void *pool, void *ptr, size_t size);
 } umf_memory_pool_ops_t;
 
 #ifdef __cplusplus
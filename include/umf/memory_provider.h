@@ -163,7 +163,9 @@ umf_memory_provider_handle_t umfGetLastFailedMemoryProvider(void);
 /// @param totalSize total size of the allocation to be split
 /// @param firstSize size of the first new allocation, second allocation
 //         has a size equal to totalSize - firstSize
-/// @return UMF_RESULT_SUCCESS on success or appropriate error code on failure
+/// @return UMF_RESULT_SUCCESS on success, UMF_RESULT_ERROR_NOT_SUPPORTED if
+///         the provider does not support splitting or appropriate error code
+///         on failure
 ///
 umf_result_t
 umfMemoryProviderAllocationSplit(umf_memory_provider_handle_t hProvider,
@@ -177,7 +179,9 @@ umfMemoryProviderAllocationSplit(umf_memory_provider_handle_t hProvider,
 /// @param highPtr pointer to the second allocation (should be > lowPtr)
 /// @param totalSize size of a new merged allocation. Should be equal
 ///        to the sum of sizes of allocations beginning at lowPtr and highPtr
-/// @return UMF_RESULT_SUCCESS on success or appropriate error code on failure
+/// @return UMF_RESULT_SUCCESS on success, UMF_RESULT_ERROR_NOT_SUPPORTED if
+///         the provider does not support merging or appropriate error code
+///         on failure
 ///
 umf_result_t
 umfMemoryProviderAllocationMerge(umf_memory_provider_handle_t hProvider,
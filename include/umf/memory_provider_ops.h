@@ -142,7 +142,8 @@ typedef struct umf_memory_provider_ops_t {
 
     ///
     /// @brief Splits a coarse grain allocation into 2 adjacent allocations that
-    ///        can be managed (freed) separately.
+    ///        can be managed (freed) separately. This operation is optional
+    ///        and can be NULL if the provider does not support it.
     /// @param hProvider handle to the memory provider
     /// @param ptr pointer to the beginning of the allocation
     /// @param totalSize total size of the allocation to be split
@@ -155,7 +156,8 @@ typedef struct umf_memory_provider_ops_t {
 
     ///
     /// @brief Merges two coarse grain allocations into a single allocation that
-    ///        can be managed (freed) as a whole.
+    ///        can be managed (freed) as a whole. This operation is optional
+    ///        and can be NULL if the provider does not support it.
     /// @param hProvider handle to the memory provider
     /// @param lowPtr pointer to the first allocation
     /// @param highPtr pointer to the second allocation (should be > lowPtr)
@@ -24,11 +24,65 @@ typedef struct umf_disjoint_pool_shared_limits_t
 umf_disjoint_pool_shared_limits_t *
 umfDisjointPoolSharedLimitsCreate(size_t MaxSize);
 
+/// @brief Create a pool limits struct shared by the pools of several
+///        processes. The pooled size is accounted in the shared memory
+///        object Name, which is created by the first process and opened by
+///        the following ones. If Name is NULL, it is placed in anonymous
+///        shared memory instead, shared with the processes forked after this
+///        call. Memory pooled by a process which exits without destroying
+///        its pools stays accounted. If the creating process dies while
+///        setting up the object, the other processes get NULL until the
+///        object is unlinked.
+/// @param Name name of the shared memory object, as for shm_open, or NULL
+/// @param MaxSize specifies hard limit for memory allocated from a provider,
+///        only used by the process which creates the shared memory object
+/// @return pointer to created pool limits struct, NULL on failure
+umf_disjoint_pool_shared_limits_t *
+umfDisjointPoolSharedLimitsCreateShared(const char *Name, size_t MaxSize);
+
+/// @brief Remove the name of the shared memory object of pool limits, the
+///        object is destroyed once all pool limits using it are destroyed
+/// @param Name name given to umfDisjointPoolSharedLimitsCreateShared
+/// @return UMF_RESULT_SUCCESS on success or UMF_RESULT_ERROR_INVALID_ARGUMENT
+umf_result_t umfDisjointPoolSharedLimitsUnlink(const char *Name);
+
 /// @brief Destroy previously created pool limits struct
 /// @param PoolLimits pointer to a pool limits struct
 void umfDisjointPoolSharedLimitsDestroy(
     umf_disjoint_pool_shared_limits_t *PoolLimits);
 
+/// @brief Callback notified when the pools sharing the limits have trimmed
+///        their pooled memory after crossing the soft limit
+/// @param Arg the argument given with the callback
+/// @param ReclaimedSize bytes of pooled memory returned to the providers
+/// @param TotalSize bytes of memory still pooled by the pools
+typedef void (*umf_disjoint_pool_reclaim_cb_t)(void *Arg, size_t ReclaimedSize,
+                                               size_t TotalSize);
+
+/// @brief Set a soft limit for the memory pooled by the pools sharing the
+///        limits, below the MaxSize hard limit. Whenever the pooled memory
+///        grows above SoftMaxSize, the pools return their pooled slabs to
+///        the providers, least recently pooled first, until it is back at
+///        SoftMaxSize, and the reclaim callback is called. With limits shared
+///        between processes, only the pools of the calling process are
+///        trimmed.
+/// @param PoolLimits pointer to a pool limits struct
+/// @param SoftMaxSize soft limit in bytes, 0 to disable it
+/// @return UMF_RESULT_SUCCESS on success or UMF_RESULT_ERROR_INVALID_ARGUMENT
+umf_result_t umfDisjointPoolSharedLimitsSetSoftLimit(
+    umf_disjoint_pool_shared_limits_t *PoolLimits, size_t SoftMaxSize);
+
+/// @brief Register the callback called after each reclaim triggered by the
+///        soft limit. The callback must not create or destroy pools sharing
+///        the limits.
+/// @param PoolLimits pointer to a pool limits struct
+/// @param Callback the callback, NULL to remove it
+/// @param Arg argument passed to the callback
+/// @return UMF_RESULT_SUCCESS on success or UMF_RESULT_ERROR_INVALID_ARGUMENT
+umf_result_t umfDisjointPoolSharedLimitsSetReclaimCallback(
+    umf_disjoint_pool_shared_limits_t *PoolLimits,
+    umf_disjoint_pool_reclaim_cb_t Callback, void *Arg);
+
 /// Configuration of Disjoint Pool
 typedef struct umf_disjoint_pool_params_t {
     /// Minimum allocation size that will be requested from the system.
@@ -58,10 +112,193 @@ typedef struct umf_disjoint_pool_params_t {
 
     /// Name used in traces
     const char *Name;
+
+    /// Maximum number of free chunks kept in a per-thread cache for each
+    /// bucket used in chunked mode. Chunks are moved between the cache and
+    /// the bucket in batches, so most allocations and frees of small sizes
+    /// don't take the bucket lock. Value of 0 disables per-thread caches.
+    size_t ThreadCacheSize;
+
+    /// Non-zero if memory returned by the memory provider is always
+    /// zero-filled (e.g. fresh mappings of the OS memory provider). calloc
+    /// then zeroes only the memory which has been used by the pool before.
+    int ProviderMemoryZeroed;
+
+    /// Non-zero to keep a separate set of buckets for each NUMA node.
+    /// Allocations are served from the buckets of the node of the CPU the
+    /// calling thread runs on and are freed back to the buckets they came
+    /// from, so pooled memory stays local to the node which first used it.
+    int PerNumaNodeBuckets;
+
+    /// Time in milliseconds after which the physical memory of a slab idle
+    /// in the pool is released with umfMemoryProviderPurgeLazy. The slab
+    /// stays in the pool and is reused without a new provider allocation.
+    /// Value of 0 disables purging.
+    size_t PurgeDecayMs;
+
+    /// Time in milliseconds after which a slab idle in the pool is returned
+    /// to the memory provider. Value of 0 keeps pooled slabs until the pool
+    /// is destroyed.
+    size_t FreeDecayMs;
+
+    /// Non-zero to purge and free idle slabs from a background thread of the
+    /// pool. Otherwise it is done from time to time on the allocation path.
+    int DecayBackgroundThread;
+
+    /// Number of bucket sizes for each doubling of the size, evenly spaced
+    /// starting from MinBucketSize. Must be a power of 2. More sizes waste
+    /// less memory per allocation at the cost of more buckets. Sizes are
+    /// never closer than 8 bytes apart, so that they stay 8-byte aligned.
+    /// Value of 0 means 2 sizes per doubling (e.g. 64, 96, 128, 192, ...).
+    size_t SizeClassesPerDoubling;
+
+    /// Optional list of NumSizeClasses bucket sizes, used instead of the
+    /// sizes generated from MinBucketSize and SizeClassesPerDoubling. The
+    /// list is copied when the pool is created and does not need to be
+    /// sorted. Sizes must be multiples of 8. Sizes above the largest listed
+    /// one use the generated sizes.
+    const size_t *SizeClasses;
+    size_t NumSizeClasses;
+
+    /// Non-zero to queue frees of chunks by threads other than the one
+    /// which last allocated from the bucket, without taking the bucket
+    /// lock. The queued chunks are reused by the next allocation from the
+    /// bucket. Only used if ThreadCacheSize is 0.
+    int RemoteFreeQueues;
+
+    /// Maximum size of slabs of buckets used in chunked mode. The slab size
+    /// of such a bucket doubles from SlabMinSize whenever all of its slabs
+    /// are full, and halves whenever none of its chunks is in use. Value of
+    /// 0 keeps all slabs at SlabMinSize.
+    size_t MaxSlabSize;
+
+    /// Maximum number of bytes of freed allocations above MaxPoolableSize
+    /// kept for reuse instead of being returned to the memory provider. A
+    /// cached allocation is reused by the smallest request it can serve,
+    /// and split if the provider supports it. The least recently freed
+    /// allocations are returned first, and PurgeDecayMs and FreeDecayMs
+    /// apply to cached allocations too. At most 128 allocations are cached
+    /// at a time. Value of 0 disables the cache.
+    size_t LargeCacheSize;
+
+    /// Number of slabs allocated with a single memory provider allocation
+    /// when a bucket runs out of slabs. The allocation is split into slabs
+    /// with umfMemoryProviderAllocationSplit, and the slabs not needed right
+    /// away are put in the pool, within Capacity and the shared limits.
+    /// Values of 0 and 1, or a provider which cannot split allocations,
+    /// allocate one slab at a time.
+    size_t SlabRefillCount;
+
+    /// Interval in milliseconds at which Capacity and MaxPoolableSize are
+    /// adjusted to the observed usage. The capacity of each bucket of whole
+    /// slabs grows when its allocations miss the pool, up to its peak slabs
+    /// in use, and shrinks when pooled slabs stay unused. MaxPoolableSize
+    /// grows when allocations just above it are frequent, and falls back
+    /// towards the configured value when they stop. Both stay within the
+    /// MaxSize of SharedLimits. Value of 0 disables the tuning.
+    size_t AutoTuneIntervalMs;
+
+    /// Number of shards of each bucket, each with its own lock and slabs, so
+    /// that threads running on different CPUs don't contend on a single
+    /// bucket. Allocations are served from the shard of the CPU the calling
+    /// thread runs on and are freed back to the shard they came from. A
+    /// shard which runs out of slabs takes a pooled slab from another shard
+    /// of the same size before allocating a new one. Capacity applies to
+    /// each shard, and with PerNumaNodeBuckets each node has its own shards.
+    /// Values of 0 and 1 disable sharding.
+    size_t NumShards;
+
+    /// Non-zero to let an allocation of a bucket of whole slabs which has
+    /// no pooled slab use a pooled slab of a larger bucket, split to the
+    /// needed size with umfMemoryProviderAllocationSplit, the excess going
+    /// back to the pool. If the provider cannot split it, a larger slab is
+    /// only used if less than half of it is wasted. Adjacent pooled slabs
+    /// of a smaller bucket are merged with umfMemoryProviderAllocationMerge
+    /// to serve the allocation if there is no larger slab.
+    int ReuseLargerSlabs;
+
+    /// Non-zero to give each thread its own slab of each bucket used in
+    /// chunked mode. The owner allocates and frees chunks of its slab
+    /// without any lock, and other threads free chunks of it with atomic
+    /// operations, which the owner reuses once its slab is full. Chunks
+    /// allocated by different threads then never share a cache line. A full
+    /// slab is given back to the bucket and replaced by an available one,
+    /// and all slabs of a thread are given back when it exits. When set,
+    /// ThreadCacheSize and RemoteFreeQueues are not used.
+    int ThreadOwnedSlabs;
 } umf_disjoint_pool_params_t;
 
 umf_memory_pool_ops_t *umfDisjointPoolOps(void);
 
+/// @brief Statistics of a single bucket of a disjoint pool
+typedef struct umf_disjoint_pool_bucket_stats_t {
+    /// Size of the allocations served by the bucket
+    size_t BucketSize;
+    /// Size of new slabs of the bucket allocated from the memory provider
+    size_t SlabSize;
+    /// Bytes currently allocated from the memory provider for the slabs
+    size_t ProviderAllocatedSize;
+    /// Number of allocations and frees served by the bucket
+    size_t AllocCount;
+    size_t FreeCount;
+    /// Number of allocations which did not need a new slab
+    size_t AllocPoolCount;
+    /// Current and peak number of slabs in use and kept in the pool
+    size_t SlabsInUse;
+    size_t SlabsInPool;
+    size_t MaxSlabsInUse;
+    size_t MaxSlabsInPool;
+    /// Current maximum number of slabs kept in the pool
+    size_t Capacity;
+} umf_disjoint_pool_bucket_stats_t;
+
+/// @brief Statistics of a disjoint pool, summed over all its buckets
+typedef struct umf_disjoint_pool_stats_t {
+    /// Number of buckets, valid indexes for umfDisjointPoolGetBucketStats
+    size_t NumBuckets;
+    /// Number of allocations and frees served by the buckets
+    size_t AllocCount;
+    size_t FreeCount;
+    /// Number of allocations which did not need a new slab
+    size_t AllocPoolCount;
+    /// Current number of slabs in use and kept in the pool
+    size_t SlabsInUse;
+    size_t SlabsInPool;
+    /// Number of allocations and frees served directly by the memory provider
+    size_t LargeAllocCount;
+    size_t LargeFreeCount;
+    /// Bytes currently allocated from the memory provider
+    size_t ProviderAllocatedSize;
+    /// Bytes of allocations above MaxPoolableSize currently kept in the
+    /// large allocation cache, and number of allocations served from it
+    size_t LargeCachedSize;
+    size_t LargeCacheHitCount;
+    /// Current size limit of the allocations served by the buckets
+    size_t MaxPoolableSize;
+} umf_disjoint_pool_stats_t;
+
+/// @brief Retrieve the statistics of a disjoint pool. Counters are updated
+///        atomically, so they can be read at any time without any tracing
+///        enabled, but they are not a consistent snapshot while other
+///        threads use the pool.
+/// @param hPool handle to a pool created with umfDisjointPoolOps()
+/// @param Stats [out] pool statistics
+/// @return UMF_RESULT_SUCCESS on success or UMF_RESULT_ERROR_INVALID_ARGUMENT
+///         if hPool is not a disjoint pool.
+umf_result_t umfDisjointPoolGetStats(umf_memory_pool_handle_t hPool,
+                                     umf_disjoint_pool_stats_t *Stats);
+
+/// @brief Retrieve the statistics of a single bucket of a disjoint pool
+/// @param hPool handle to a pool created with umfDisjointPoolOps()
+/// @param BucketIdx index of the bucket, less than NumBuckets of the pool
+///        statistics
+/// @param Stats [out] bucket statistics
+/// @return UMF_RESULT_SUCCESS on success or UMF_RESULT_ERROR_INVALID_ARGUMENT
+///         if hPool is not a disjoint pool or BucketIdx is out of range.
+umf_result_t
+umfDisjointPoolGetBucketStats(umf_memory_pool_handle_t hPool, size_t BucketIdx,
+                              umf_disjoint_pool_bucket_stats_t *Stats);
+
 /// @brief Create default params struct for disjoint pool
 static inline umf_disjoint_pool_params_t umfDisjointPoolParamsDefault(void) {
     umf_disjoint_pool_params_t params = {
@@ -72,7 +309,24 @@ static inline umf_disjoint_pool_params_t umfDisjointPoolParamsDefault(void) {
         0,                                         /* CurPoolSize */
         0,                                         /* PoolTrace */
         NULL,                                      /* SharedLimits */
-        "disjoint_pool"                            /* Name */
+        "disjoint_pool",                           /* Name */
+        0,                                         /* ThreadCacheSize */
+        0,                                         /* ProviderMemoryZeroed */
+        0,                                         /* PerNumaNodeBuckets */
+        0,                                         /* PurgeDecayMs */
+        0,                                         /* FreeDecayMs */
+        0,                                         /* DecayBackgroundThread */
+        0,                                         /* SizeClassesPerDoubling */
+        NULL,                                      /* SizeClasses */
+        0,                                         /* NumSizeClasses */
+        0,                                         /* RemoteFreeQueues */
+        0,                                         /* MaxSlabSize */
+        0,                                         /* LargeCacheSize */
+        0,                                         /* SlabRefillCount */
+        0,                                         /* AutoTuneIntervalMs */
+        0,                                         /* NumShards */
+        0,                                         /* ReuseLargerSlabs */
+        0                                          /* ThreadOwnedSlabs */
     };
 
     return params;
@@ -18,8 +18,10 @@
 #include <array>
 #include <functional>
 #include <memory>
+#include <new>
 #include <stdexcept>
 #include <tuple>
+#include <type_traits>
 #include <utility>
 
 namespace umf {
@@ -31,6 +33,14 @@ using provider_unique_handle_t =
     std::unique_ptr<umf_memory_provider_t,
                     std::function<void(umf_memory_provider_handle_t)>>;
 
+// Exceptions thrown by the operations are turned into error codes. Code
+// built without exceptions, e.g. with -fno-exceptions, reports errors
+// through return values only, so the operations are called directly.
+#if defined(__cpp_exceptions) || defined(__EXCEPTIONS) || defined(_CPPUNWIND)
+#define UMF_CPP_EXCEPTIONS 1
+#endif
+
+#ifdef UMF_CPP_EXCEPTIONS
 #define UMF_ASSIGN_OP(ops, type, func, default_return)                         \
     ops.func = [](void *obj, auto... args) {                                   \
         try {                                                                  \
@@ -47,11 +57,24 @@ using provider_unique_handle_t =
         } catch (...) {                                                        \
         }                                                                      \
     }
+#else
+#define UMF_ASSIGN_OP(ops, type, func, default_return)                         \
+    ops.func = [](void *obj, auto... args) {                                   \
+        return reinterpret_cast<type *>(obj)->func(args...);                   \
+    }
+
+#define UMF_ASSIGN_OP_NORETURN(ops, type, func)                                \
+    ops.func = [](void *obj, auto... args) {                                   \
+        return reinterpret_cast<type *>(obj)->func(args...);                   \
+    }
+#endif
 
 namespace detail {
 template <typename T, typename ArgsTuple>
 umf_result_t initialize(T *obj, ArgsTuple &&args) {
+#ifdef UMF_CPP_EXCEPTIONS
     try {
+#endif
         auto ret = std::apply(&T::initialize,
                               std::tuple_cat(std::make_tuple(obj),
                                              std::forward<ArgsTuple>(args)));
@@ -59,12 +82,21 @@ umf_result_t initialize(T *obj, ArgsTuple &&args) {
             delete obj;
         }
         return ret;
+#ifdef UMF_CPP_EXCEPTIONS
     } catch (...) {
         delete obj;
         return UMF_RESULT_ERROR_UNKNOWN;
     }
+#endif
 }
 
+// Whether T implements the optional free_sized operation
+template <typename T, typename = void>
+struct has_free_sized : std::false_type {};
+template <typename T>
+struct has_free_sized<T, std::void_t<decltype(&T::free_sized)>>
+    : std::true_type {};
+
 template <typename T> umf_memory_pool_ops_t poolOpsBase() {
     umf_memory_pool_ops_t ops{};
     ops.version = UMF_VERSION_CURRENT;
@@ -76,6 +108,9 @@ template <typename T> umf_memory_pool_ops_t poolOpsBase() {
     UMF_ASSIGN_OP(ops, T, malloc_usable_size, ((size_t)0));
     UMF_ASSIGN_OP(ops, T, free, UMF_RESULT_SUCCESS);
     UMF_ASSIGN_OP(ops, T, get_last_allocation_error, UMF_RESULT_ERROR_UNKNOWN);
+    if constexpr (has_free_sized<T>::value) {
+        UMF_ASSIGN_OP(ops, T, free_sized, UMF_RESULT_SUCCESS);
+    }
     return ops;
 }
 
@@ -103,9 +138,8 @@ template <typename T, typename ParamType> umf_memory_pool_ops_t poolMakeCOps() {
 
     ops.initialize = [](umf_memory_provider_handle_t provider, void *params,
                         void **obj) {
-        try {
-            *obj = new T;
-        } catch (...) {
+        *obj = new (std::nothrow) T;
+        if (!*obj) {
             return UMF_RESULT_ERROR_OUT_OF_HOST_MEMORY;
         }
 
@@ -131,9 +165,8 @@ umf_memory_provider_ops_t providerMakeCOps() {
     umf_memory_provider_ops_t ops = detail::providerOpsBase<T>();
 
     ops.initialize = [](void *params, void **obj) {
-        try {
-            *obj = new T;
-        } catch (...) {
+        *obj = new (std::nothrow) T;
+        if (!*obj) {
             return UMF_RESULT_ERROR_OUT_OF_HOST_MEMORY;
         }
 
@@ -63,6 +63,15 @@ umf_result_t umfPoolFree(umf_memory_pool_handle_t hPool, void *ptr) {
     return hPool->ops.free(hPool->pool_priv, ptr);
 }
 
+umf_result_t umfPoolFreeSized(umf_memory_pool_handle_t hPool, void *ptr,
+                              size_t size) {
+    UMF_CHECK((hPool != NULL), UMF_RESULT_ERROR_INVALID_ARGUMENT);
+    if (!hPool->ops.free_sized) {
+        return hPool->ops.free(hPool->pool_priv, ptr);
+    }
+    return hPool->ops.free_sized(hPool->pool_priv, ptr, size);
+}
+
 umf_result_t umfPoolGetLastAllocationError(umf_memory_pool_handle_t hPool) {
     UMF_CHECK((hPool != NULL), UMF_RESULT_ERROR_INVALID_ARGUMENT);
     return hPool->ops.get_last_allocation_error(hPool->pool_priv);
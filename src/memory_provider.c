@@ -159,6 +159,9 @@ umfMemoryProviderAllocationSplit(umf_memory_provider_handle_t hProvider,
     if (firstSize >= totalSize) {
         return UMF_RESULT_ERROR_INVALID_ARGUMENT;
     }
+    if (!hProvider->ops.allocation_split) {
+        return UMF_RESULT_ERROR_NOT_SUPPORTED;
+    }
 
     umf_result_t res = hProvider->ops.allocation_split(
         hProvider->provider_priv, ptr, totalSize, firstSize);
@@ -182,6 +185,9 @@ umfMemoryProviderAllocationMerge(umf_memory_provider_handle_t hProvider,
     if ((uintptr_t)highPtr - (uintptr_t)lowPtr > totalSize) {
         return UMF_RESULT_ERROR_INVALID_ARGUMENT;
     }
+    if (!hProvider->ops.allocation_merge) {
+        return UMF_RESULT_ERROR_NOT_SUPPORTED;
+    }
 
     umf_result_t res = hProvider->ops.allocation_merge(
         hProvider->provider_priv, lowPtr, highPtr, totalSize);
@@ -8,30 +8,36 @@
 #include <bitset>
 #include <cassert>
 #include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
 #include <iomanip>
 #include <limits>
-#include <list>
 #include <memory>
 #include <mutex>
-#include <shared_mutex>
+#include <new>
 #include <string>
-#include <unordered_map>
+#include <thread>
 #include <utility>
 #include <vector>
 
 // TODO: replace with logger?
 #include <iostream>
 
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define DISJOINT_POOL_STREAM_ZERO 1
+#endif
+
+#include "../base_alloc/base_alloc.h"
 #include "../cpp_helpers.hpp"
+#include "../critnib/critnib.h"
+#include "../memory_pool_internal.h"
 #include "pool_disjoint.h"
 #include "umf.h"
+#include "utils_common.h"
 #include "utils_math.h"
 
-typedef struct umf_disjoint_pool_shared_limits_t {
-    size_t MaxSize;
-    std::atomic<size_t> TotalSize;
-} umf_disjoint_pool_shared_limits_t;
-
 class DisjointPool {
   public:
     class AllocImpl;
@@ -45,8 +51,13 @@ class DisjointPool {
     void *aligned_malloc(size_t size, size_t alignment);
     size_t malloc_usable_size(void *);
     umf_result_t free(void *ptr);
+    umf_result_t free_sized(void *ptr, size_t size);
     umf_result_t get_last_allocation_error();
 
+    void getStats(umf_disjoint_pool_stats_t *Stats);
+    umf_result_t getBucketStats(size_t BucketIdx,
+                                umf_disjoint_pool_bucket_stats_t *Stats);
+
     DisjointPool();
     ~DisjointPool();
 
@@ -54,9 +65,101 @@ class DisjointPool {
     std::unique_ptr<AllocImpl> impl;
 };
 
+// Accounting of shared limits in shared memory, used by the pools of all
+// the processes mapping it.
+struct SharedLimitsSegment {
+    enum : uint32_t { Uninitialized, Initializing, Ready };
+    std::atomic<uint32_t> State;
+    size_t MaxSize;
+    std::atomic<size_t> TotalSize;
+};
+static_assert(std::atomic<size_t>::is_always_lock_free &&
+                  std::atomic<uint32_t>::is_always_lock_free,
+              "Atomics in shared memory must be lock-free");
+
+// Setting up a segment takes a few stores, a segment which is not ready
+// after this long was left behind by a process which died meanwhile.
+static constexpr auto SharedLimitsInitTimeout = std::chrono::seconds(1);
+
+typedef struct umf_disjoint_pool_shared_limits_t {
+    umf_disjoint_pool_shared_limits_t(size_t MaxSize)
+        : MaxSize(MaxSize), TotalSize(LocalTotalSize) {}
+    umf_disjoint_pool_shared_limits_t(SharedLimitsSegment &Segment)
+        : MaxSize(Segment.MaxSize), TotalSize(Segment.TotalSize),
+          Segment(&Segment) {}
+    ~umf_disjoint_pool_shared_limits_t() {
+        if (Segment) {
+            util_unmap_shared_memory(Segment, sizeof(*Segment));
+        }
+    }
+
+    size_t MaxSize;
+
+    // Size of the memory pooled by all the pools using the limits, which is
+    // LocalTotalSize unless the limits are in shared memory.
+    std::atomic<size_t> LocalTotalSize{0};
+    std::atomic<size_t> &TotalSize;
+    SharedLimitsSegment *Segment = nullptr;
+
+    // Above SoftMaxSize, the pools using the limits return their least
+    // recently pooled slabs to the providers. 0 if there is no soft limit.
+    std::atomic<size_t> SoftMaxSize{0};
+
+    // The pools using the limits, linked through AllocImpl::LimitsNext, and
+    // the reclaim callback, protected by Lock, which is also held by the
+    // thread reclaiming the memory.
+    DisjointPool::AllocImpl *Pools = nullptr;
+    umf_disjoint_pool_reclaim_cb_t ReclaimCb = nullptr;
+    void *ReclaimArg = nullptr;
+    std::mutex Lock;
+} umf_disjoint_pool_shared_limits_t;
+
 umf_disjoint_pool_shared_limits_t *
 umfDisjointPoolSharedLimitsCreate(size_t MaxSize) {
-    return new umf_disjoint_pool_shared_limits_t{MaxSize, 0};
+    return new (std::nothrow) umf_disjoint_pool_shared_limits_t(MaxSize);
+}
+
+umf_disjoint_pool_shared_limits_t *
+umfDisjointPoolSharedLimitsCreateShared(const char *Name, size_t MaxSize) {
+    auto *Segment = static_cast<SharedLimitsSegment *>(
+        util_map_shared_memory(Name, sizeof(SharedLimitsSegment)));
+    if (!Segment) {
+        return nullptr;
+    }
+
+    // The process which finds the zero-filled segment first sets it up,
+    // the others wait until it is done.
+    uint32_t State = SharedLimitsSegment::Uninitialized;
+    if (Segment->State.compare_exchange_strong(
+            State, SharedLimitsSegment::Initializing)) {
+        Segment->MaxSize = MaxSize;
+        Segment->TotalSize = 0;
+        Segment->State = SharedLimitsSegment::Ready;
+    } else {
+        auto Deadline =
+            std::chrono::steady_clock::now() + SharedLimitsInitTimeout;
+        while (Segment->State.load() != SharedLimitsSegment::Ready) {
+            if (std::chrono::steady_clock::now() >= Deadline) {
+                util_unmap_shared_memory(Segment, sizeof(SharedLimitsSegment));
+                return nullptr;
+            }
+            std::this_thread::yield();
+        }
+    }
+
+    auto *Limits =
+        new (std::nothrow) umf_disjoint_pool_shared_limits_t(*Segment);
+    if (!Limits) {
+        util_unmap_shared_memory(Segment, sizeof(SharedLimitsSegment));
+    }
+    return Limits;
+}
+
+umf_result_t umfDisjointPoolSharedLimitsUnlink(const char *Name) {
+    if (!Name || util_unlink_shared_memory(Name) != 0) {
+        return UMF_RESULT_ERROR_INVALID_ARGUMENT;
+    }
+    return UMF_RESULT_SUCCESS;
 }
 
 void umfDisjointPoolSharedLimitsDestroy(
@@ -64,6 +167,27 @@ void umfDisjointPoolSharedLimitsDestroy(
     delete limits;
 }
 
+umf_result_t umfDisjointPoolSharedLimitsSetSoftLimit(
+    umf_disjoint_pool_shared_limits_t *limits, size_t SoftMaxSize) {
+    if (!limits) {
+        return UMF_RESULT_ERROR_INVALID_ARGUMENT;
+    }
+    limits->SoftMaxSize = SoftMaxSize;
+    return UMF_RESULT_SUCCESS;
+}
+
+umf_result_t umfDisjointPoolSharedLimitsSetReclaimCallback(
+    umf_disjoint_pool_shared_limits_t *limits,
+    umf_disjoint_pool_reclaim_cb_t Callback, void *Arg) {
+    if (!limits) {
+        return UMF_RESULT_ERROR_INVALID_ARGUMENT;
+    }
+    std::lock_guard<std::mutex> Lg(limits->Lock);
+    limits->ReclaimCb = Callback;
+    limits->ReclaimArg = Arg;
+    return UMF_RESULT_SUCCESS;
+}
+
 // Allocations are a minimum of 4KB/64KB/2MB even when a smaller size is
 // requested. The implementation distinguishes between allocations of size
 // ChunkCutOff = (minimum-alloc-size / 2) and those that are larger.
@@ -84,6 +208,13 @@ void umfDisjointPoolSharedLimitsDestroy(
 // go directly to the provider.
 static constexpr size_t CutOff = (size_t)1 << 31; // 2GB
 
+// With AutoTuneIntervalMs, the capacity of a bucket grows when at least one
+// in AutoTuneMissRatio of its allocations needs a new slab, and
+// MaxPoolableSize grows when at least AutoTuneMinAllocs allocations of up to
+// twice its value were seen during an interval.
+static constexpr size_t AutoTuneMissRatio = 8;
+static constexpr size_t AutoTuneMinAllocs = 16;
+
 // Aligns the pointer down to the specified alignment
 // (e.g. returns 8 for Size = 13, Alignment = 8)
 static void *AlignPtrDown(void *Ptr, const size_t Alignment) {
@@ -109,71 +240,212 @@ static size_t AlignUp(size_t Val, size_t Alignment) {
     return (Val + Alignment - 1) & (~(Alignment - 1));
 }
 
-typedef struct MemoryProviderError {
-    umf_result_t code;
-} MemoryProviderError_t;
+// Allocations of at least this size are zeroed with non-temporal stores,
+// so that zeroing them does not evict the whole cache.
+static constexpr size_t NonTemporalZeroThreshold = (size_t)1 << 20; // 1MB
+
+// Fill the memory with zeros
+static void zeroMemory(void *Ptr, size_t Size) {
+#ifdef DISJOINT_POOL_STREAM_ZERO
+    if (Size >= NonTemporalZeroThreshold) {
+        auto *Begin = static_cast<char *>(Ptr);
+        auto *AlignedBegin = static_cast<char *>(AlignPtrUp(Begin, 64));
+        auto *AlignedEnd = static_cast<char *>(AlignPtrDown(Begin + Size, 64));
+
+        std::memset(Begin, 0, AlignedBegin - Begin);
+
+        const __m128i Zero = _mm_setzero_si128();
+        for (auto *Line = AlignedBegin; Line < AlignedEnd; Line += 64) {
+            _mm_stream_si128(reinterpret_cast<__m128i *>(Line), Zero);
+            _mm_stream_si128(reinterpret_cast<__m128i *>(Line + 16), Zero);
+            _mm_stream_si128(reinterpret_cast<__m128i *>(Line + 32), Zero);
+            _mm_stream_si128(reinterpret_cast<__m128i *>(Line + 48), Zero);
+        }
+        _mm_sfence();
+
+        std::memset(AlignedEnd, 0, Begin + Size - AlignedEnd);
+        return;
+    }
+#endif
+    std::memset(Ptr, 0, Size);
+}
+
+// Current time in milliseconds, used for decay of pooled slabs
+static uint64_t getTimeMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
 
 class Bucket;
+class Slab;
+class SlabList;
+class ThreadCache;
+
+// A free chunk along with the slab it belongs to
+struct CachedChunk {
+    void *Ptr;
+    Slab *OwnerSlab;
+    // The chunk still holds the zero-filled memory of the provider
+    bool Zeroed;
+};
 
 // Represents the allocated memory block of size 'SlabMinSize'
 // Internally, it splits the memory block into chunks. The number of
 // chunks depends of the size of a Bucket which created the Slab.
 // Note: Bucket's methods are responsible for thread safety of Slab access,
 // so no locking happens here.
+// Slab objects are allocated by their bucket from a base allocator pool,
+// together with the chunk bitmaps which are placed right after the object.
 class Slab {
 
-    // Pointer to the allocated memory of SlabMinSize bytes
+    // Pointer to the allocated memory of SlabSize bytes
     void *MemPtr;
+    size_t SlabSize;
+
+    static constexpr size_t BitsPerWord = 64;
 
     // Represents the current state of each chunk:
-    // if the bit is set then the chunk is allocated
-    // the chunk is free for allocation otherwise
-    std::vector<bool> Chunks;
+    // if the bit is set then the chunk is free for allocation
+    // the chunk is allocated otherwise
+    uint64_t *Chunks;
+
+    // Summary of Chunks: bit i is set if word i of Chunks has at least one
+    // free chunk, so the first free chunk is found with two bit scans.
+    uint64_t *FreeWords;
+    size_t NumFreeWords;
+
+    // Total number of chunks in the slab.
+    size_t NumChunks;
 
     // Total number of allocated chunks at the moment.
     size_t NumAllocated = 0;
 
+    // Chunks from this index on have never been allocated, so they still
+    // hold the zero-filled memory of the provider. Equal to NumChunks if
+    // the provider memory is not known to be zeroed.
+    size_t NumTouched;
+
     // The bucket which the slab belongs to
     Bucket &bucket;
 
-    using ListIter = std::list<std::unique_ptr<Slab>>::iterator;
-
-    // Store iterator to the corresponding node in avail/unavail list
-    // to achieve O(1) removal
-    ListIter SlabListIter;
-
-    // Hints where to start search for free chunk in a slab
-    size_t FirstFreeChunkIdx = 0;
+    // Time when the slab was put in the pool, and whether its memory has
+    // been purged since then. Only maintained if decay or a soft limit of
+    // the shared limits is enabled.
+    uint64_t PooledSince = 0;
+    bool Purged = false;
+
+    // Set once the memory has been handed over by detach().
+    bool Detached = false;
+
+    // Chunks freed by threads which don't own the bucket, set without the
+    // bucket lock and moved to Chunks by the next owner of the lock. The
+    // chunk memory itself is never written, it may not be host accessible.
+    std::atomic<uint64_t> *RemoteFreed;
+
+    // Set while the slab is in the remote-free list of its bucket.
+    std::atomic<bool> InRemoteList{false};
+    Slab *RemoteNext = nullptr;
+
+    // Number of remote frees between setting their bit in RemoteFreed and
+    // adding the slab to the remote-free list. The chunk may already be
+    // reclaimed meanwhile, but the slab is neither pooled nor freed.
+    std::atomic<uint32_t> RemoteFreesInFlight{0};
+    friend class Bucket;
+
+    // With ThreadOwnedSlabs, the thread which owns the slab, nullptr if it
+    // is in the lists of its bucket. Only the owner uses Chunks without the
+    // lock, other threads free chunks through RemoteFreed.
+    std::atomic<const void *> Owner{nullptr};
+
+    // Neighbours in the avail/unavail list of the bucket, to achieve O(1)
+    // removal without allocating list nodes.
+    Slab *Prev = nullptr;
+    Slab *Next = nullptr;
+    // The list the slab is in. It can be checked for slabs found in the
+    // slab map, which may belong to other buckets.
+    std::atomic<const SlabList *> List{nullptr};
+    friend class SlabList;
 
     // Return the index of the first available chunk, SIZE_MAX otherwise
     size_t FindFirstAvailableChunkIdx() const;
 
     // Register/Unregister the slab in the global slab address map.
-    void regSlab(Slab &);
+    umf_result_t regSlab(Slab &);
     void unregSlab(Slab &);
-    static void regSlabByAddr(void *, Slab &);
-    static void unregSlabByAddr(void *, Slab &);
+
+    static size_t numChunkWords(size_t NumChunks) {
+        return (NumChunks + BitsPerWord - 1) / BitsPerWord;
+    }
 
   public:
-    Slab(Bucket &);
+    // Bitmap storage of NumChunks chunks must follow the object. The slab
+    // memory is allocated by init().
+    Slab(Bucket &, size_t SlabSize, size_t NumChunks);
     ~Slab();
 
-    void setIterator(ListIter It) { SlabListIter = It; }
-    ListIter getIterator() const { return SlabListIter; }
+    // Allocate the slab memory, aligned to Alignment if it is non-zero, and
+    // register the slab. The object is not destroyed if this fails.
+    umf_result_t init(size_t Alignment = 0);
+
+    // Use Mem, a provider allocation of the slab size made by the caller, as
+    // the slab memory and register the slab. The caller keeps the ownership
+    // of Mem if this fails. Used is set if the memory has held data before,
+    // so that none of it is considered zero-filled.
+    umf_result_t attach(void *Mem, bool Used = false);
+
+    // Unregister the slab and return its memory, which the caller takes
+    // over. The object is then destroyed without freeing the memory.
+    void *detach();
+
+    Slab(const Slab &) = delete;
+    Slab &operator=(const Slab &) = delete;
+
+    // Size of the memory needed for a Slab object with NumChunks chunks,
+    // including its bitmaps.
+    static size_t allocSize(size_t NumChunks) {
+        size_t NumWords = numChunkWords(NumChunks);
+        return sizeof(Slab) +
+               (NumWords + numChunkWords(NumWords)) * sizeof(uint64_t) +
+               NumWords * sizeof(std::atomic<uint64_t>);
+    }
 
     size_t getNumAllocated() const { return NumAllocated; }
 
+    // The next slab in the list which this slab belongs to.
+    Slab *getNext() const { return Next; }
+
+    void markPooled(uint64_t Now) {
+        PooledSince = Now;
+        Purged = false;
+    }
+    uint64_t getPooledSince() const { return PooledSince; }
+    bool isPurged() const { return Purged; }
+
+    // Release the physical memory of the slab, it can be used again
+    // without any call to the provider.
+    void purge();
+
     // Get pointer to allocation that is one piece of this slab.
-    void *getChunk();
+    // Zeroed is set if the chunk has never been used.
+    void *getChunk(bool &Zeroed);
 
     // Get pointer to allocation that is this entire slab.
     void *getSlab();
 
     void *getPtr() const { return MemPtr; }
     void *getEnd() const;
+    size_t getSlabSize() const { return SlabSize; }
 
     size_t getChunkSize() const;
-    size_t getNumChunks() const { return Chunks.size(); }
+    size_t getNumChunks() const { return NumChunks; }
+
+    // Get pointer to the beginning of the chunk which contains Ptr.
+    void *getChunkStart(void *Ptr) const;
+
+    // Number of bytes available to the allocation at Ptr, up to the end of
+    // its chunk or of the entire slab.
+    size_t getUsableSize(void *Ptr);
 
     bool hasAvail();
 
@@ -181,20 +453,191 @@ class Slab {
     const Bucket &getBucket() const;
 
     void freeChunk(void *Ptr);
+
+    // Mark the chunk at Ptr as freed by a thread not holding the bucket
+    // lock. Returns true if the slab has to be added to the remote-free
+    // list of its bucket.
+    bool freeChunkRemote(void *Ptr);
+
+    // Move the chunks freed remotely to the free chunks of the slab, with
+    // the bucket lock held.
+    void reclaimRemoteFrees();
+
+    // Move the chunks freed remotely to the free chunks of the slab,
+    // leaving it in the remote-free list if it is there. Used by the thread
+    // which owns the slab, without the lock.
+    void takeRemoteFrees();
+
+    // Whether the slab is in the remote-free list of its bucket. An empty
+    // slab in that list is neither pooled nor freed until it is reclaimed.
+    bool isInRemoteList() const {
+        return InRemoteList.load(std::memory_order_acquire);
+    }
+
+    bool hasRemoteFreesInFlight() const {
+        return RemoteFreesInFlight.load(std::memory_order_acquire) != 0;
+    }
+
+    const void *getOwner() const {
+        return Owner.load(std::memory_order_relaxed);
+    }
+};
+
+// Intrusive doubly-linked list of slabs. Slabs are linked through their
+// Prev/Next pointers, so a slab can be in at most one list at a time.
+class SlabList {
+    Slab *Head = nullptr;
+    size_t Count = 0;
+
+  public:
+    bool empty() const { return Head == nullptr; }
+    size_t size() const { return Count; }
+    Slab *front() const { return Head; }
+    bool contains(const Slab &S) const {
+        return S.List.load(std::memory_order_relaxed) == this;
+    }
+
+    void push_front(Slab &S) {
+        assert(!S.Prev && !S.Next);
+        S.List.store(this, std::memory_order_relaxed);
+        S.Next = Head;
+        if (Head) {
+            Head->Prev = &S;
+        }
+        Head = &S;
+        ++Count;
+    }
+
+    void remove(Slab &S) {
+        assert(Count > 0);
+        if (S.Prev) {
+            S.Prev->Next = S.Next;
+        } else {
+            assert(Head == &S);
+            Head = S.Next;
+        }
+        if (S.Next) {
+            S.Next->Prev = S.Prev;
+        }
+        S.Prev = S.Next = nullptr;
+        S.List.store(nullptr, std::memory_order_relaxed);
+        --Count;
+    }
+};
+
+// The least recently pooled slabs found so far, up to a fixed number, so
+// that they are collected under the locks without allocating.
+class OldestPooledSlabs {
+  public:
+    static constexpr size_t Capacity = 64;
+
+    // Add a slab pooled at PooledSince, in place of the most recently
+    // pooled one if there is no room left.
+    void add(uint64_t PooledSince, size_t Size) {
+        if (Count == Capacity) {
+            if (PooledSince >= Slabs[0].first) {
+                return;
+            }
+            std::pop_heap(Slabs.begin(), Slabs.begin() + Count);
+            Count--;
+        }
+        Slabs[Count++] = {PooledSince, Size};
+        std::push_heap(Slabs.begin(), Slabs.begin() + Count);
+    }
+
+    bool empty() const { return !Count; }
+
+    // The time at which the least recently pooled slabs of at least Size
+    // bytes in total were pooled, or the latest one if they are not
+    // enough. Called once all the slabs are added.
+    uint64_t pooledBefore(size_t Size) {
+        std::sort_heap(Slabs.begin(), Slabs.begin() + Count);
+        uint64_t PooledBefore = 0;
+        size_t Total = 0;
+        for (size_t Idx = 0; Idx < Count && Total < Size; Idx++) {
+            PooledBefore = Slabs[Idx].first;
+            Total += Slabs[Idx].second;
+        }
+        return PooledBefore;
+    }
+
+  private:
+    // Max-heap by the time the slabs were pooled at, and their sizes.
+    std::array<std::pair<uint64_t, size_t>, Capacity> Slabs;
+    size_t Count = 0;
 };
 
 class Bucket {
     const size_t Size;
 
+    // Index of this bucket among all the buckets of the pool.
+    const size_t Idx;
+
+    // Chunk index of an offset within a slab is computed as
+    // (Offset * ChunkIdxMul) >> ChunkIdxShift instead of a division.
+    // ChunkIdxMul equal to 0 means the division has to be used.
+    uint64_t ChunkIdxMul;
+    size_t ChunkIdxShift;
+
     // List of slabs which have at least 1 available chunk.
-    std::list<std::unique_ptr<Slab>> AvailableSlabs;
+    SlabList AvailableSlabs;
 
     // List of slabs with 0 available chunk.
-    std::list<std::unique_ptr<Slab>> UnavailableSlabs;
+    SlabList UnavailableSlabs;
+
+    // With ThreadOwnedSlabs, list of slabs owned by threads.
+    SlabList OwnedSlabs;
+
+    // Allocation size of new slabs. For buckets used in chunked mode it
+    // grows from SlabMinSize up to MaxSlabSize while the bucket runs out of
+    // free chunks, and shrinks again once none of its chunks is in use.
+    size_t CurSlabSize;
+
+    // Allocators of Slab objects of this bucket, the one at index k is for
+    // slabs of (SlabMinSize << k) bytes and is created with the first one.
+    // Entries don't change once set, so they are read without the lock.
+    std::array<umf_ba_pool_t *, sizeof(size_t) * 8> SlabAllocators{};
+
+    // Number of pooled slabs taken out of the available list by decay while
+    // their memory is purged.
+    size_t NumPurging = 0;
+
+    // Total size of the slabs of this bucket
+    std::atomic<size_t> AllocatedSize{0};
+
+    // The next bucket of the same size in the ring of the shards of a node,
+    // this bucket if the pool is not sharded. Set when the pool is created.
+    Bucket *NextShard = this;
+
+    // The buckets of the next smaller and larger sizes of the same node and
+    // shard, nullptr at the ends. Set when the pool is created.
+    Bucket *Smaller = nullptr;
+    Bucket *Larger = nullptr;
+
+    // Capacity of a bucket of whole slabs, adjusted by tune() if
+    // AutoTuneIntervalMs is set.
+    std::atomic<size_t> TunedCapacity;
+
+    // Peak slabs in use and fewest slabs in the pool since the last tune(),
+    // protected by BucketLock.
+    size_t TuneMaxSlabsInUse = 0;
+    size_t TuneMinSlabsInPool = 0;
+
+    // Allocation counts at the last tune(), only used by the tuning thread.
+    size_t TuneAllocCount = 0;
+    size_t TuneAllocPoolCount = 0;
 
     // Protects the bucket and all the corresponding slabs
     std::mutex BucketLock;
 
+    // With RemoteFreeQueues, the thread which allocated chunks last. Chunks
+    // freed by other threads are queued without taking BucketLock.
+    std::atomic<const void *> Owner{nullptr};
+
+    // Lock-free stack of slabs with chunks freed by threads other than the
+    // owner, linked through Slab::RemoteNext. Emptied with BucketLock held.
+    std::atomic<Slab *> RemoteFreeSlabs{nullptr};
+
     // Reference to the allocator context, used access memory allocation
     // routines, slab map and etc.
     DisjointPool::AllocImpl &OwnAllocCtx;
@@ -218,56 +661,129 @@ class Bucket {
     // if a slab in this bucket is already pooled.
     size_t chunkedSlabsInPool;
 
-    // Statistics
-    size_t allocPoolCount;
-    size_t freeCount;
-    size_t currSlabsInUse;
-    size_t currSlabsInPool;
-    size_t maxSlabsInPool;
+    // Statistics, the slab counts are updated under BucketLock but all of
+    // them can be read at any time by umfDisjointPoolGetStats.
+    std::atomic<size_t> allocPoolCount;
+    std::atomic<size_t> freeCount;
+    std::atomic<size_t> currSlabsInUse;
+    std::atomic<size_t> currSlabsInPool;
+    std::atomic<size_t> maxSlabsInPool;
+    std::atomic<size_t> allocCount;
+    std::atomic<size_t> maxSlabsInUse;
 
   public:
-    // Statistics
-    size_t allocCount;
-    size_t maxSlabsInUse;
+    Bucket(size_t Sz, size_t Idx, DisjointPool::AllocImpl &AllocCtx);
 
-    Bucket(size_t Sz, DisjointPool::AllocImpl &AllocCtx)
-        : Size{Sz}, OwnAllocCtx{AllocCtx}, chunkedSlabsInPool(0),
-          allocPoolCount(0), freeCount(0), currSlabsInUse(0),
-          currSlabsInPool(0), maxSlabsInPool(0), allocCount(0),
-          maxSlabsInUse(0) {}
+    ~Bucket();
+
+    Bucket(const Bucket &) = delete;
+    Bucket &operator=(const Bucket &) = delete;
+
+    // Return the index of the chunk at the given offset within a slab.
+    size_t getChunkIdx(size_t Offset) const {
+        if (ChunkIdxMul) {
+            auto Idx = static_cast<size_t>((uint64_t(Offset) * ChunkIdxMul) >>
+                                           ChunkIdxShift);
+            assert(Idx == Offset / Size);
+            return Idx;
+        }
+        return Offset / Size;
+    }
 
     // Get pointer to allocation that is one piece of an available slab in this
-    // bucket.
-    void *getChunk(bool &FromPool);
+    // bucket. Zeroed is set if the memory is known to be zero-filled.
+    umf_result_t getChunk(void **Ptr, bool &FromPool, bool &Zeroed);
 
-    // Get pointer to allocation that is a full slab in this bucket.
-    void *getSlab(bool &FromPool);
+    // Get pointer to allocation that is a full slab in this bucket, aligned
+    // to Alignment if it is non-zero.
+    // Zeroed is set if the memory is known to be zero-filled.
+    umf_result_t getSlab(void **Ptr, bool &FromPool, bool &Zeroed,
+                         size_t Alignment = 0);
 
     // Return the allocation size of this bucket.
     size_t getSize() const { return Size; }
 
+    // Return the index of this bucket among all the buckets of the pool.
+    size_t getIdx() const { return Idx; }
+
     // Free an allocation that is one piece of a slab in this bucket.
     void freeChunk(void *Ptr, Slab &Slab, bool &ToPool);
 
+    // Get up to Count chunks under a single lock acquisition. A new slab is
+    // allocated only if there is no available slab for the first chunk.
+    // NumChunks is set to the number of chunks stored in Chunks.
+    umf_result_t getChunks(CachedChunk *Chunks, size_t Count,
+                           size_t &NumChunks, bool &FromPool);
+
+    // Free a batch of chunks of this bucket under a single lock acquisition.
+    void freeChunks(const CachedChunk *Chunks, size_t Count, bool &ToPool);
+
+    // Get a chunk of Owned, the slab of this size owned by the calling
+    // thread, without the lock. If it is full, it is given back and an
+    // available slab of this bucket becomes Owned.
+    umf_result_t getOwnedChunk(Slab *&Owned, void **Ptr, bool &FromPool,
+                               bool &Zeroed);
+
+    // Free a chunk with ThreadOwnedSlabs. Only frees of chunks of slabs
+    // which no thread owns take the lock.
+    void freeOwnedChunk(void *Ptr, Slab &Slab, bool &ToPool);
+
+    // Give a slab owned by a thread back to the lists of the bucket.
+    void releaseSlab(Slab &Slab);
+
     // Free an allocation that is a full slab in this bucket.
     void freeSlab(Slab &Slab, bool &ToPool);
 
+    // Purge or free the slabs which have been in the pool for long enough.
+    void decay(uint64_t Now);
+
+    // Adjust the capacity to the use of the bucket since the previous call
+    // and return the number of allocations in that time.
+    size_t tune();
+
+    // Link the bucket to the next shard of the same size.
+    void setNextShard(Bucket &Next) { NextShard = &Next; }
+
+    // Link the bucket to the one of the next larger size, and back.
+    void setLarger(Bucket &Next) {
+        Larger = &Next;
+        Next.Smaller = this;
+    }
+
+    // Add the slabs in the pool to the least recently pooled ones.
+    void collectPooled(OldestPooledSlabs &Oldest);
+
+    // Return the slabs pooled at PooledBefore or earlier to the provider,
+    // up to MaxSize bytes. Returns the size of the freed slabs.
+    size_t trimPooled(uint64_t PooledBefore, size_t MaxSize);
+
     umf_memory_provider_handle_t getMemHandle();
 
     DisjointPool::AllocImpl &getAllocCtx() { return OwnAllocCtx; }
 
-    // Check whether an allocation to be freed can be placed in the pool.
-    bool CanPool(bool &ToPool);
+    // Whether memory of new slabs is zero-filled by the provider.
+    bool isProviderMemoryZeroed();
+
+    // Check whether a slab to be freed can be placed in the pool.
+    bool CanPool(Slab &Slab, bool &ToPool);
 
     // The minimum allocation size for any slab.
     size_t SlabMinSize();
 
-    // The allocation size for a slab in this bucket.
+    // The allocation size for a new slab in this bucket.
     size_t SlabAllocSize();
 
+    // The largest allocation size for a slab in this bucket.
+    size_t MaxSlabAllocSize();
+
     // The minimum size of a chunk from this bucket's slabs.
     size_t ChunkCutOff();
 
+    // Whether this bucket splits its slabs into chunks rather than handing
+    // out each slab as a whole. All allocation and free paths of a bucket
+    // must agree on this, so it only depends on the bucket size.
+    bool isChunked();
+
     // The number of slabs in this bucket that can be in the pool.
     size_t Capacity();
 
@@ -281,94 +797,344 @@ class Bucket {
     void countFree();
 
     // Update statistics of Available/Unavailable
-    void updateStats(int InUse, int InPool);
+    void updateStats(int InUse, int InPool, size_t SlabSize);
 
     // Print bucket statistics
     void printStats(bool &TitlePrinted, const std::string &Label);
 
+    void getStats(umf_disjoint_pool_bucket_stats_t &Stats);
+
   private:
-    void onFreeChunk(Slab &, bool &ToPool);
+    // WasFull tells whether the slab had no available chunk before. A slab
+    // to be freed is moved to ToDestroy, to be destroyed without the lock.
+    void onFreeChunk(Slab &, bool WasFull, bool &ToPool, SlabList &ToDestroy);
+
+    // Whether frees of chunks by the current thread are queued.
+    bool isRemoteFree();
+
+    // Queue a chunk freed by a thread which is not the owner.
+    void freeChunkRemote(void *Ptr, Slab &Slab);
+
+    // Add a slab to the remote-free list, once InRemoteList is set.
+    void pushRemoteFreeSlab(Slab &Slab);
+
+    // Return the chunks freed by other threads to their slabs. The lock must
+    // be acquired before calling this method.
+    void reclaimRemoteFrees(SlabList &ToDestroy);
+
+    // Make the current thread the owner of the bucket and reclaim the
+    // chunks freed by other threads, or only reclaim them with
+    // ThreadOwnedSlabs. The lock must be acquired before calling this
+    // method.
+    void takeOwnership(SlabList &ToDestroy);
+
+    void initChunkIdxReciprocal();
+
+    // Record the time when a slab entered the pool, if decay is enabled.
+    void onSlabPooled(Slab &Slab);
+
+    // Take a chunk of an available slab.
+    // The lock must be acquired before calling this method
+    void *takeChunk(Slab &ChunkSlab, bool &Zeroed);
+
+    // Call WithSlab with the lock held and an available slab. If there is
+    // none, a new slab is allocated without the lock and published.
+    template <typename WithSlabFn>
+    umf_result_t withAvailSlab(bool &FromPool, WithSlabFn &&WithSlab);
 
     // Update statistics of pool usage, and indicate that an allocation was made
     // from the pool.
-    void decrementPool(bool &FromPool);
-
-    // Get a slab to be used for chunked allocations.
-    decltype(AvailableSlabs.begin()) getAvailSlab(bool &FromPool);
+    void decrementPool(Slab &Slab, bool &FromPool);
+
+    // Get a slab to be used for chunked allocations, nullptr if there is
+    // no available slab.
+    Slab *getAvailSlab(bool &FromPool);
+
+    // Get a pooled slab that will be used as a whole for a single
+    // allocation, nullptr if there is none.
+    Slab *getAvailFullSlab(size_t Alignment);
+
+    // Size of the next new slab of this bucket.
+    // The lock must be acquired before calling this method
+    size_t nextSlabSize();
+
+    // Allocate a new slab of this bucket, which is not in any list yet.
+    // Called without the lock, as it calls the memory provider.
+    umf_result_t createSlab(umf_ba_pool_t *SlabAllocator, size_t SlabSize,
+                            size_t Alignment, Slab *&NewSlab);
+
+    // Number of slabs to allocate at once when the bucket runs out of them.
+    // The lock must be acquired before calling this method
+    size_t refillCount(size_t SlabSize);
+
+    // Allocate up to Count new slabs with a single provider allocation split
+    // into slabs, or a single slab if that fails. The slabs are added to
+    // NewSlabs, the one with the lowest address last.
+    // Called without the lock, as it calls the memory provider.
+    umf_result_t createSlabs(umf_ba_pool_t *SlabAllocator, size_t SlabSize,
+                             size_t Count, SlabList &NewSlabs);
+
+    // Whether the slab of the available list is entirely free, i.e. in the
+    // pool. The lock must be acquired before calling this method
+    bool isPooled(Slab &Slab) {
+        return Slab.getNumAllocated() == 0 && !Slab.isInRemoteList();
+    }
 
-    // Get a slab that will be used as a whole for a single allocation.
-    decltype(AvailableSlabs.begin()) getAvailFullSlab(bool &FromPool);
+    // Take a slab out of the pool and move it to To.
+    // The lock must be acquired before calling this method
+    void unpoolSlab(Slab &Slab, SlabList &To);
+
+    // Put all but one of the new slabs in the pool and return the remaining
+    // one, which is counted as in use. Slabs which can't be pooled are moved
+    // to ToDestroy. The lock must be acquired before calling this method
+    Slab *publishSlabs(SlabList &NewSlabs, SlabList &ToDestroy);
+
+    // Take a pooled slab from another shard of this size, if any has one,
+    // and add it to NewSlabs. Called without the lock.
+    bool stealSlab(SlabList &NewSlabs);
+
+    // Give up an entirely free slab of the pool of at most MaxSlabSize
+    // bytes to another bucket, Mem and SlabSize are set to its memory which
+    // the caller takes over. Called without the lock.
+    bool giveSlab(void *&Mem, size_t &SlabSize,
+                  size_t MaxSlabSize = (std::numeric_limits<size_t>::max)());
+
+    // Take a pooled slab of a larger bucket, or adjacent pooled slabs of a
+    // smaller bucket merged together, and add it to NewSlabs. Only used for
+    // buckets of whole slabs with ReuseLargerSlabs. Called without the lock.
+    bool reuseSlab(SlabList &NewSlabs);
+
+    // Give up a run of adjacent pooled slabs of at least MinSize and at
+    // most MaxSize bytes in total, merged into a single allocation which the
+    // caller takes over. Called without the lock.
+    bool giveMergedSlabs(size_t MinSize, size_t MaxSize, void *&Mem,
+                         size_t &Size);
+
+    // The pooled slab of this bucket right after Slab in memory, nullptr if
+    // there is none. The lock must be acquired before calling this method.
+    Slab *nextPooledSlab(Slab &Slab);
+
+    // Add a slab of SlabSize bytes at Mem, memory which has been used
+    // before, to NewSlabs. The caller keeps the ownership of Mem if this
+    // fails. Called without the lock.
+    bool attachSlab(void *Mem, size_t SlabSize, SlabList &NewSlabs);
+
+    // Put a slab of SlabSize bytes at Mem in the pool, or return it to the
+    // provider if the pool is full. Called without the lock.
+    void poolSlab(void *Mem, size_t SlabSize);
+
+    // Split the free memory at Mem into slabs of this bucket and the smaller
+    // ones and pool them, the rest is returned to the provider. Called
+    // without the lock.
+    void poolRegion(void *Mem, size_t Size);
+
+    // Free the slab object and its memory, without the lock.
+    void destroySlab(Slab *Slab);
+    void destroySlabs(SlabList &Slabs);
+
+    // Allocator of the objects of slabs of SlabSize bytes, created if
+    // needed, nullptr if that fails.
+    // The lock must be acquired before calling this method
+    umf_ba_pool_t *getSlabAllocator(size_t SlabSize);
+    size_t getSlabAllocatorIdx(size_t SlabSize);
+
+    // Move a slab from one list to another.
+    static void moveSlab(Slab &Slab, SlabList &From, SlabList &To) {
+        From.remove(Slab);
+        To.push_front(Slab);
+    }
 };
 
 class DisjointPool::AllocImpl {
     // It's important for the map to be destroyed last after buckets and their
     // slabs This is because slab's destructor removes the object from the map.
-    std::unordered_multimap<void *, Slab &> KnownSlabs;
-    std::shared_timed_mutex KnownSlabsMapLock;
+    // Slabs are keyed by their start address, so a slab that contains a given
+    // pointer is found by a lock-free "less or equal" lookup.
+    std::unique_ptr<critnib, decltype(&critnib_delete)> KnownSlabs;
+
+    // Allocations served directly by the memory provider, keyed by their
+    // address, with their sizes as values.
+    std::unique_ptr<critnib, decltype(&critnib_delete)> LargeAllocs;
 
     // Handle to the memory provider
     umf_memory_provider_handle_t MemHandle;
 
     // Store as unique_ptrs since Bucket is not Movable(because of std::mutex)
-    std::vector<std::unique_ptr<Bucket>> Buckets;
+    // There is a set of NumBucketsPerSet consecutive buckets, one for each
+    // size class, for each shard of each NUMA node.
+    std::unique_ptr<std::unique_ptr<Bucket>[]> Buckets;
+    size_t NumBuckets = 0;
+    size_t NumBucketsPerSet = 0;
+    size_t NumNodes;
+    size_t NumShards;
 
     // Configuration for this instance
     umf_disjoint_pool_params_t params;
 
-    umf_disjoint_pool_shared_limits_t DefaultSharedLimits = {
-        (std::numeric_limits<size_t>::max)(), 0};
+    umf_disjoint_pool_shared_limits_t DefaultSharedLimits{
+        (std::numeric_limits<size_t>::max)()};
+
+    // Sizes of the NumBucketsPerSet buckets of a set, in increasing order.
+    std::unique_ptr<size_t[]> SizeClasses;
+
+    // Index of the bucket for each size up to SmallSizeMax, so that finding
+    // the bucket of small allocations takes a single lookup.
+    static constexpr size_t SmallSizeMax = 1024;
+    std::array<uint16_t, SmallSizeMax + 1> SmallSizeIdx;
 
-    // Used in algorithm for finding buckets
-    std::size_t MinBucketSizeExp;
+    // Index of the first bucket larger than 2^i, where the search for the
+    // bucket of larger allocations starts.
+    size_t FirstIdxAbovePow2[sizeof(size_t) * 8];
 
     // Coarse-grain allocation min alignment
     size_t ProviderMinPageSize;
 
+    // Unique identifier of this pool instance, used by threads to find
+    // their caches
+    const uint64_t PoolId;
+
+    // Per-thread caches created for this pool, protected by ThreadCachesLock
+    ThreadCache *ThreadCaches = nullptr;
+
+    // Neighbours in the list of pools of the shared limits, protected by
+    // their Lock.
+    AllocImpl *LimitsPrev = nullptr;
+    AllocImpl *LimitsNext = nullptr;
+    bool InLimits = false;
+
+    // Cleared once the provider reports it cannot merge allocations, so that
+    // pooled slabs are not coalesced anymore.
+    std::atomic<bool> CanMerge{true};
+
+    // Statistics of allocations served directly by the memory provider.
+    // LargeAllocatedSize includes the cached allocations.
+    std::atomic<size_t> LargeAllocCount{0};
+    std::atomic<size_t> LargeFreeCount{0};
+    std::atomic<size_t> LargeAllocatedSize{0};
+
+    // A freed allocation above MaxPoolableSize kept for reuse, linked in a
+    // bin or in the list of free slots.
+    struct LargeExtent {
+        void *Ptr;
+        size_t Size;
+        uint64_t FreedAt;
+        bool Purged;
+        LargeExtent *Next;
+    };
+
+    // Cached large allocations in bins by the log2 of their size, protected
+    // by LargeCacheLock. The extents are fixed slots, so that caching never
+    // allocates; an allocation freed while no slot is left goes back to the
+    // provider. LargeCachedSize also counts the extents taken out of the
+    // bins while they are purged.
+    static constexpr size_t MaxLargeExtents = 128;
+    std::array<LargeExtent, MaxLargeExtents> LargeExtents;
+    LargeExtent *FreeLargeExtents = nullptr;
+    std::array<LargeExtent *, sizeof(size_t) * 8> LargeCacheBins{};
+    std::mutex LargeCacheLock;
+    std::atomic<size_t> LargeCachedSize{0};
+    std::atomic<size_t> LargeCacheHitCount{0};
+
+    // Cleared once the provider reports it cannot split allocations, so that
+    // cached allocations are only reused as a whole and slabs are allocated
+    // one by one.
+    std::atomic<bool> CanSplit{true};
+
+    // Size limit of the allocations served by the buckets, adjusted between
+    // the MaxPoolableSize parameter and MaxTunedPoolableSize by tune().
+    std::atomic<size_t> PoolableSize;
+    size_t MaxTunedPoolableSize;
+
+    // Allocations of up to twice PoolableSize served by the provider since
+    // the last tune().
+    std::atomic<size_t> NearPoolableAllocs{0};
+
+    // Time of the next tune(), unused if AutoTuneIntervalMs is 0.
+    // TuneLock keeps tune() calls from overlapping.
+    std::atomic<uint64_t> NextTuneMs{0};
+    std::mutex TuneLock;
+
+    // Interval of decay of pooled slabs, 0 if decay is disabled.
+    uint64_t DecayPeriodMs = 0;
+
+    // Time of the next decay driven by the allocation path.
+    std::atomic<uint64_t> NextDecayMs{0};
+
+    // Optional thread which applies the decay instead of allocations.
+    std::thread DecayThread;
+    std::mutex DecayLock;
+    std::condition_variable DecayCv;
+    bool StopDecay = false;
+
   public:
     AllocImpl(umf_memory_provider_handle_t hProvider,
               umf_disjoint_pool_params_t *params)
-        : MemHandle{hProvider}, params(*params) {
+        : KnownSlabs(critnib_new(), &critnib_delete),
+          LargeAllocs(critnib_new(), &critnib_delete), MemHandle{hProvider},
+          params(*params), PoolId(NextPoolId++) {
 
-        // Generate buckets sized such as: 64, 96, 128, 192, ..., CutOff.
-        // Powers of 2 and the value halfway between the powers of 2.
-        auto Size1 = this->params.MinBucketSize;
-        // MinBucketSize cannot be larger than CutOff.
-        Size1 = std::min(Size1, CutOff);
-        // Buckets sized smaller than the bucket default size- 8 aren't needed.
-        Size1 = std::max(Size1, UMF_DISJOINT_POOL_MIN_BUCKET_DEFAULT_SIZE);
-        // Calculate the exponent for MinBucketSize used for finding buckets.
-        MinBucketSizeExp = (size_t)log2Utils(Size1);
-        auto Size2 = Size1 + Size1 / 2;
-        for (; Size2 < CutOff; Size1 *= 2, Size2 *= 2) {
-            Buckets.push_back(std::make_unique<Bucket>(Size1, *this));
-            Buckets.push_back(std::make_unique<Bucket>(Size2, *this));
-        }
-        Buckets.push_back(std::make_unique<Bucket>(CutOff, *this));
+        NumNodes = this->params.PerNumaNodeBuckets
+                       ? std::max(util_get_numa_nodes_count(), size_t(1))
+                       : 1;
 
-        auto ret = umfMemoryProviderGetMinPageSize(hProvider, nullptr,
-                                                   &ProviderMinPageSize);
-        if (ret != UMF_RESULT_SUCCESS) {
-            ProviderMinPageSize = 0;
+        NumShards = std::max(this->params.NumShards, size_t(1));
+
+        for (auto &Extent : LargeExtents) {
+            Extent.Next = FreeLargeExtents;
+            FreeLargeExtents = &Extent;
         }
     }
 
+    // Set up the buckets and the rest of the state which may fail to be
+    // allocated, before the pool is used.
+    umf_result_t init();
+
+    ~AllocImpl();
+
     void *allocate(size_t Size, size_t Alignment, bool &FromPool);
     void *allocate(size_t Size, bool &FromPool);
-    void deallocate(void *Ptr, bool &ToPool);
+    void *allocateZeroed(size_t Size, bool &FromPool);
+
+    // Size is the size requested for the allocation if it is known, 0
+    // otherwise.
+    umf_result_t deallocate(void *Ptr, bool &ToPool, size_t Size = 0);
+    void *reallocate(void *Ptr, size_t Size);
+    size_t getUsableSize(void *Ptr);
+
+    uint64_t getPoolId() const { return PoolId; }
+
+    // Register/Unregister a per-thread cache of this pool.
+    // ThreadCachesLock must be held by the caller.
+    void addThreadCache(ThreadCache *Cache);
+    void removeThreadCache(ThreadCache *Cache);
+    size_t getNumBuckets() const { return NumBuckets; }
 
     umf_memory_provider_handle_t getMemHandle() { return MemHandle; }
 
-    std::shared_timed_mutex &getKnownSlabsMapLock() {
-        return KnownSlabsMapLock;
+    // Whether the provider may split its allocations of Size bytes.
+    bool canSplit(size_t Size) {
+        return ProviderMinPageSize && Size % ProviderMinPageSize == 0 &&
+               CanSplit.load(std::memory_order_relaxed);
     }
-    std::unordered_multimap<void *, Slab &> &getKnownSlabs() {
-        return KnownSlabs;
+    void onSplitNotSupported() { CanSplit = false; }
+
+    // Whether the provider may merge adjacent allocations.
+    bool canMerge() {
+        return ProviderMinPageSize && CanMerge.load(std::memory_order_relaxed);
     }
+    void onMergeNotSupported() { CanMerge = false; }
+
+    critnib *getKnownSlabs() { return KnownSlabs.get(); }
+    critnib *getLargeAllocs() { return LargeAllocs.get(); }
 
     size_t SlabMinSize() { return params.SlabMinSize; };
 
     umf_disjoint_pool_params_t &getParams() { return params; }
 
+    size_t getMaxPoolableSize() {
+        return PoolableSize.load(std::memory_order_relaxed);
+    }
+
     umf_disjoint_pool_shared_limits_t *getLimits() {
         if (params.SharedLimits) {
             return params.SharedLimits;
@@ -380,26 +1146,205 @@ class DisjointPool::AllocImpl {
     void printStats(bool &TitlePrinted, size_t &HighBucketSize,
                     size_t &HighPeakSlabsInUse, const std::string &Label);
 
+    void getStats(umf_disjoint_pool_stats_t &Stats);
+    umf_result_t getBucketStats(size_t BucketIdx,
+                                umf_disjoint_pool_bucket_stats_t &Stats);
+
+    // Trim the pools sharing the limits of this pool if their pooled memory
+    // is above the soft limit. Called after memory is pooled.
+    void checkSoftLimit();
+
+    // Add the slabs in the pool to the least recently pooled ones.
+    void collectPooled(OldestPooledSlabs &Oldest);
+
+    // Return the slabs pooled at PooledBefore or earlier to the provider,
+    // up to MaxSize bytes. Returns the size of the freed slabs.
+    size_t trimPooled(uint64_t PooledBefore, size_t MaxSize);
+
   private:
     Bucket &findBucket(size_t Size);
+
+    // Find the slab which contains Ptr, nullptr if there is none.
+    Slab *findSlab(void *Ptr);
+
+    // Allocate/Free memory directly from/to the memory provider, through
+    // the large allocation cache if it is enabled. FromPool is set if the
+    // allocation comes from the cache.
+    umf_result_t allocateLarge(void **Ptr, size_t Size, size_t Alignment,
+                               bool &FromPool);
+    umf_result_t deallocateLarge(void *Ptr);
+
+    // Take the smallest cached allocation of at least Size bytes aligned to
+    // Alignment out of the cache, split off its tail if it is larger than
+    // needed. Size is set to the size of the returned allocation.
+    bool takeCachedLarge(void **Ptr, size_t &Size, size_t Alignment);
+
+    // Keep a freed large allocation in the cache, returning the least
+    // recently freed ones to the provider to stay within LargeCacheSize.
+    void cacheLarge(void *Ptr, size_t Size);
+
+    // Return all cached large allocations to the provider.
+    void flushLargeCache();
+
+    // Return a large allocation, which is not used anymore, to the provider.
+    void freeLarge(void *Ptr, size_t Size);
+
+    // Give the slots of a list of extents back. The lock must be acquired
+    // before calling this method.
+    void releaseLargeExtents(LargeExtent *Extents);
+
+    // Purge or free the cached large allocations idle for long enough.
+    void decayLargeCache(uint64_t Now);
+
+    // Size of the provider allocation at Ptr, 0 if it is not known.
+    size_t getLargeAllocSize(void *Ptr);
+
+    // Return the tail of a provider allocation beyond Size to the provider.
+    void shrinkLarge(void *Ptr, size_t OldSize, size_t Size);
+
+    // Compute the bucket sizes and the tables used to find buckets.
+    umf_result_t initSizeClasses();
+
     std::size_t sizeToIdx(size_t Size);
+
+    // Start the decay of pooled slabs if it is enabled.
+    void initDecay();
+
+    // Apply the decay if it is due, called on the allocation path.
+    void tickDecay();
+
+    // Purge or free the slabs of all buckets which stay in the pool for
+    // long enough.
+    void decay(uint64_t Now);
+
+    // Set the bounds of MaxPoolableSize tuning and schedule the first one.
+    void initAutoTune();
+
+    // Count an allocation of Size bytes served by the provider, and apply
+    // the tuning if it is due. Called on the allocation path.
+    void tickAutoTune(size_t Size);
+
+    // Adjust the capacity of the buckets and MaxPoolableSize to the use of
+    // the pool since the previous call.
+    void tune();
+
+    // Zeroed is set if the allocated memory is known to be zero-filled.
+    void *allocate(size_t Size, bool &FromPool, bool &Zeroed);
+
+    // Get/Free a chunk of a bucket through the calling thread's cache if
+    // per-thread caches are enabled, directly from/to the bucket otherwise.
+    umf_result_t getChunk(Bucket &Bucket, void **Ptr, bool &FromPool,
+                          bool &Zeroed);
+    void freeChunk(Bucket &Bucket, void *Ptr, Slab &Slab, bool &ToPool);
+
+    static std::atomic<uint64_t> NextPoolId;
+};
+
+std::atomic<uint64_t> DisjointPool::AllocImpl::NextPoolId{0};
+
+// Cache of free chunks owned by a single thread, one per pool used by that
+// thread. Each bucket used in chunked mode gets a bounded stack of chunks that
+// is refilled from and flushed to the bucket in batches, so only every
+// ThreadCacheSize/2-th allocation or free takes the bucket lock.
+class ThreadCache {
+    struct BucketCache {
+        std::unique_ptr<CachedChunk[]> Chunks;
+        size_t Count = 0;
+
+        // With ThreadOwnedSlabs, the slab owned by the thread instead of
+        // the cached chunks.
+        Slab *OwnedSlab = nullptr;
+    };
+
+    // The pool this cache belongs to, nullptr once the pool is destroyed.
+    // Protected by ThreadCachesLock.
+    DisjointPool::AllocImpl *AllocCtx;
+    const uint64_t PoolId;
+    const size_t Capacity;
+
+    // One cache for each bucket of the pool, allocated by init(). A thread
+    // which moves to another node or shard uses the caches of its buckets,
+    // and chunks are always flushed to the bucket they came from.
+    std::unique_ptr<BucketCache[]> Caches;
+    size_t NumCaches = 0;
+
+    // Links in the list of caches of the thread and in the list of caches
+    // of the pool, so that adding a cache never allocates.
+    ThreadCache *ThreadNext = nullptr;
+    ThreadCache *PoolPrev = nullptr;
+    ThreadCache *PoolNext = nullptr;
+    friend class ThreadCacheList;
+    friend class DisjointPool::AllocImpl;
+
+    // Return the first Count chunks of the cache to their buckets.
+    void flush(BucketCache &Cache, size_t Count, bool &ToPool);
+
+    // Allocate the chunk stack of a bucket cache on first use.
+    umf_result_t initChunks(BucketCache &Cache);
+
+  public:
+    ThreadCache(DisjointPool::AllocImpl &AllocCtx, size_t Capacity)
+        : AllocCtx(&AllocCtx), PoolId(AllocCtx.getPoolId()),
+          Capacity(Capacity) {}
+
+    umf_result_t init(size_t NumBuckets);
+
+    uint64_t getPoolId() const { return PoolId; }
+    DisjointPool::AllocImpl *getAllocCtx() const { return AllocCtx; }
+    void detach() { AllocCtx = nullptr; }
+
+    umf_result_t getChunk(Bucket &Bucket, size_t BucketIdx, void **Ptr,
+                          bool &FromPool, bool &Zeroed);
+    void freeChunk(size_t BucketIdx, void *Ptr, Slab &Slab, bool &ToPool);
+
+    // Get a chunk of the slab owned by the thread, with ThreadOwnedSlabs.
+    umf_result_t getOwnedChunk(Bucket &Bucket, size_t BucketIdx, void **Ptr,
+                               bool &FromPool, bool &Zeroed);
+
+    // Return all cached chunks and owned slabs to their buckets.
+    void flush();
 };
 
-static void *memoryProviderAlloc(umf_memory_provider_handle_t hProvider,
-                                 size_t size, size_t alignment = 0) {
-    void *ptr;
-    auto ret = umfMemoryProviderAlloc(hProvider, size, alignment, &ptr);
-    if (ret != UMF_RESULT_SUCCESS) {
-        throw MemoryProviderError{ret};
+// Protects the association between pools and per-thread caches: the list of
+// caches of each pool and the AllocCtx of each cache.
+static std::mutex ThreadCachesLock;
+
+// All caches of the current thread. Cached chunks are returned to their pools
+// when the thread exits.
+class ThreadCacheList {
+    ThreadCache *Head = nullptr;
+
+  public:
+    ~ThreadCacheList();
+
+    ThreadCache *find(uint64_t PoolId) const {
+        for (auto *Cache = Head; Cache; Cache = Cache->ThreadNext) {
+            if (Cache->getPoolId() == PoolId) {
+                return Cache;
+            }
+        }
+        return nullptr;
     }
-    return ptr;
-}
 
-static void memoryProviderFree(umf_memory_provider_handle_t hProvider,
-                               void *ptr) {
-    auto ret = umfMemoryProviderFree(hProvider, ptr, 0);
-    if (ret != UMF_RESULT_SUCCESS) {
-        throw MemoryProviderError{ret};
+    // Create the cache of the current thread for the pool, nullptr if it
+    // can't be allocated.
+    ThreadCache *create(DisjointPool::AllocImpl &AllocCtx, size_t Capacity);
+};
+
+static thread_local ThreadCacheList LocalThreadCaches;
+
+// Report an error of the memory provider which can't be returned to the
+// user of the pool.
+static void printProviderError(umf_result_t ret) {
+    std::cerr << "DisjointPool: error from memory provider: " << ret << "\n";
+    if (ret == UMF_RESULT_ERROR_MEMORY_PROVIDER_SPECIFIC) {
+        const char *message = "";
+        int error = 0;
+
+        umfMemoryProviderGetLastNativeError(umfGetLastFailedMemoryProvider(),
+                                            &message, &error);
+        std::cerr << "Native error msg: " << message
+                  << ", native error code: " << error << std::endl;
     }
 }
 
@@ -413,120 +1358,145 @@ std::ostream &operator<<(std::ostream &Os, const Slab &Slab) {
     return Os;
 }
 
-Slab::Slab(Bucket &Bkt)
-    : // In case bucket size is not a multiple of SlabMinSize, we would have
-      // some padding at the end of the slab.
-      Chunks(Bkt.SlabMinSize() / Bkt.getSize()), NumAllocated{0},
-      bucket(Bkt), SlabListIter{}, FirstFreeChunkIdx{0} {
-    auto SlabSize = Bkt.SlabAllocSize();
-    MemPtr = memoryProviderAlloc(Bkt.getMemHandle(), SlabSize);
-    regSlab(*this);
+Slab::Slab(Bucket &Bkt, size_t SlabSize, size_t NumChunks)
+    : SlabSize(SlabSize), NumChunks(NumChunks), NumAllocated{0},
+      NumTouched(Bkt.isProviderMemoryZeroed() ? 0 : NumChunks), bucket(Bkt) {
+    // All chunks are free initially
+    size_t NumWords = numChunkWords(NumChunks);
+    Chunks = reinterpret_cast<uint64_t *>(this + 1);
+    std::fill_n(Chunks, NumWords, ~uint64_t(0));
+    if (NumChunks % BitsPerWord) {
+        Chunks[NumWords - 1] = (uint64_t(1) << (NumChunks % BitsPerWord)) - 1;
+    }
+
+    NumFreeWords = numChunkWords(NumWords);
+    FreeWords = Chunks + NumWords;
+    std::fill_n(FreeWords, NumFreeWords, ~uint64_t(0));
+    if (NumWords % BitsPerWord) {
+        FreeWords[NumFreeWords - 1] =
+            (uint64_t(1) << (NumWords % BitsPerWord)) - 1;
+    }
+
+    RemoteFreed = reinterpret_cast<std::atomic<uint64_t> *>(FreeWords +
+                                                            NumFreeWords);
+    for (size_t i = 0; i < NumWords; i++) {
+        new (&RemoteFreed[i]) std::atomic<uint64_t>(0);
+    }
 }
 
-Slab::~Slab() {
-    try {
-        unregSlab(*this);
-    } catch (std::exception &e) {
-        std::cerr << "DisjointPool: unexpected error: " << e.what() << "\n";
+umf_result_t Slab::init(size_t Alignment) {
+    auto Ret = umfMemoryProviderAlloc(bucket.getMemHandle(), SlabSize,
+                                      Alignment, &MemPtr);
+    if (Ret != UMF_RESULT_SUCCESS) {
+        return Ret;
+    }
+
+    Ret = regSlab(*this);
+    if (Ret != UMF_RESULT_SUCCESS) {
+        umfMemoryProviderFree(bucket.getMemHandle(), MemPtr, SlabSize);
     }
+    return Ret;
+}
 
-    try {
-        memoryProviderFree(bucket.getMemHandle(), MemPtr);
-    } catch (MemoryProviderError &e) {
-        std::cerr << "DisjointPool: error from memory provider: " << e.code
-                  << "\n";
-        if (e.code == UMF_RESULT_ERROR_MEMORY_PROVIDER_SPECIFIC) {
-            const char *message = "";
-            int error = 0;
+umf_result_t Slab::attach(void *Mem, bool Used) {
+    MemPtr = Mem;
+    if (Used) {
+        NumTouched = NumChunks;
+    }
+    return regSlab(*this);
+}
 
-            umfMemoryProviderGetLastNativeError(
-                umfGetLastFailedMemoryProvider(), &message, &error);
-            std::cerr << "Native error msg: " << message
-                      << ", native error code: " << error << std::endl;
-        }
+void *Slab::detach() {
+    unregSlab(*this);
+    Detached = true;
+    return MemPtr;
+}
+
+Slab::~Slab() {
+    if (Detached) {
+        return;
+    }
+    unregSlab(*this);
+
+    auto Ret = umfMemoryProviderFree(bucket.getMemHandle(), MemPtr, SlabSize);
+    if (Ret != UMF_RESULT_SUCCESS) {
+        printProviderError(Ret);
     }
 }
 
 // Return the index of the first available chunk, SIZE_MAX otherwise
 size_t Slab::FindFirstAvailableChunkIdx() const {
-    // Use the first free chunk index as a hint for the search.
-    auto It = std::find_if(Chunks.begin() + FirstFreeChunkIdx, Chunks.end(),
-                           [](auto x) { return !x; });
-    if (It != Chunks.end()) {
-        return It - Chunks.begin();
+    // There are at most a few summary words, even for the smallest buckets.
+    for (size_t i = 0; i < NumFreeWords; i++) {
+        if (FreeWords[i]) {
+            size_t WordIdx =
+                i * BitsPerWord + getRightmostSetBitPos(FreeWords[i]);
+            return WordIdx * BitsPerWord +
+                   getRightmostSetBitPos(Chunks[WordIdx]);
+        }
     }
 
     return std::numeric_limits<size_t>::max();
 }
 
-void *Slab::getChunk() {
+void *Slab::getChunk(bool &Zeroed) {
     // assert(NumAllocated != Chunks.size());
 
     const size_t ChunkIdx = FindFirstAvailableChunkIdx();
     // Free chunk must exist, otherwise we would have allocated another slab
     assert(ChunkIdx != (std::numeric_limits<size_t>::max()));
 
+    Zeroed = ChunkIdx >= NumTouched;
+    if (Zeroed) {
+        NumTouched = ChunkIdx + 1;
+    }
+
     void *const FreeChunk =
         (static_cast<uint8_t *>(getPtr())) + ChunkIdx * getChunkSize();
-    Chunks[ChunkIdx] = true;
-    NumAllocated += 1;
 
-    // Use the found index as the next hint
-    FirstFreeChunkIdx = ChunkIdx;
+    size_t WordIdx = ChunkIdx / BitsPerWord;
+    Chunks[WordIdx] &= ~(uint64_t(1) << (ChunkIdx % BitsPerWord));
+    if (!Chunks[WordIdx]) {
+        FreeWords[WordIdx / BitsPerWord] &=
+            ~(uint64_t(1) << (WordIdx % BitsPerWord));
+    }
+    NumAllocated += 1;
 
     return FreeChunk;
 }
 
 void *Slab::getSlab() { return getPtr(); }
 
+void Slab::purge() {
+    // Errors are ignored, the memory just stays populated.
+    umfMemoryProviderPurgeLazy(bucket.getMemHandle(), MemPtr, SlabSize);
+    Purged = true;
+}
+
 Bucket &Slab::getBucket() { return bucket; }
 const Bucket &Slab::getBucket() const { return bucket; }
 
 size_t Slab::getChunkSize() const { return bucket.getSize(); }
 
-void Slab::regSlabByAddr(void *Addr, Slab &Slab) {
-    auto &Lock = Slab.getBucket().getAllocCtx().getKnownSlabsMapLock();
-    auto &Map = Slab.getBucket().getAllocCtx().getKnownSlabs();
+umf_result_t Slab::regSlab(Slab &Slab) {
+    auto *Map = Slab.getBucket().getAllocCtx().getKnownSlabs();
 
-    std::lock_guard<std::shared_timed_mutex> Lg(Lock);
-    Map.insert({Addr, Slab});
+    // Slabs never overlap, so their start addresses are unique keys.
+    int Ret = critnib_insert(Map, reinterpret_cast<uintptr_t>(Slab.getPtr()),
+                             &Slab, 0 /* update */);
+    if (Ret) {
+        return UMF_RESULT_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    return UMF_RESULT_SUCCESS;
 }
 
-void Slab::unregSlabByAddr(void *Addr, Slab &Slab) {
-    auto &Lock = Slab.getBucket().getAllocCtx().getKnownSlabsMapLock();
-    auto &Map = Slab.getBucket().getAllocCtx().getKnownSlabs();
-
-    std::lock_guard<std::shared_timed_mutex> Lg(Lock);
+void Slab::unregSlab(Slab &Slab) {
+    auto *Map = Slab.getBucket().getAllocCtx().getKnownSlabs();
 
-    auto Slabs = Map.equal_range(Addr);
-    // At least the must get the current slab from the map.
-    assert(Slabs.first != Slabs.second && "Slab is not found");
-
-    for (auto It = Slabs.first; It != Slabs.second; ++It) {
-        if (It->second == Slab) {
-            Map.erase(It);
-            return;
-        }
-    }
-
-    assert(false && "Slab is not found");
-}
-
-void Slab::regSlab(Slab &Slab) {
-    void *StartAddr = AlignPtrDown(Slab.getPtr(), bucket.SlabMinSize());
-    void *EndAddr = static_cast<char *>(StartAddr) + bucket.SlabMinSize();
-
-    regSlabByAddr(StartAddr, Slab);
-    regSlabByAddr(EndAddr, Slab);
-}
-
-void Slab::unregSlab(Slab &Slab) {
-    void *StartAddr = AlignPtrDown(Slab.getPtr(), bucket.SlabMinSize());
-    void *EndAddr = static_cast<char *>(StartAddr) + bucket.SlabMinSize();
-
-    unregSlabByAddr(StartAddr, Slab);
-    unregSlabByAddr(EndAddr, Slab);
-}
+    [[maybe_unused]] void *Removed =
+        critnib_remove(Map, reinterpret_cast<uintptr_t>(Slab.getPtr()));
+    assert(Removed == &Slab && "Slab is not found");
+}
 
 void Slab::freeChunk(void *Ptr) {
     // This method should be called through bucket(since we might remove the slab
@@ -537,428 +1507,2523 @@ void Slab::freeChunk(void *Ptr) {
 
     // Even if the pointer p was previously aligned, it's still inside the
     // corresponding chunk, so we get the correct index here.
-    auto ChunkIdx = (static_cast<char *>(Ptr) - static_cast<char *>(MemPtr)) /
-                    getChunkSize();
+    auto ChunkIdx = bucket.getChunkIdx(static_cast<char *>(Ptr) -
+                                       static_cast<char *>(MemPtr));
+
+    size_t WordIdx = ChunkIdx / BitsPerWord;
+    uint64_t ChunkBit = uint64_t(1) << (ChunkIdx % BitsPerWord);
 
     // Make sure that the chunk was allocated
-    assert(Chunks[ChunkIdx] && "double free detected");
+    assert(!(Chunks[WordIdx] & ChunkBit) && "double free detected");
 
-    Chunks[ChunkIdx] = false;
+    Chunks[WordIdx] |= ChunkBit;
+    FreeWords[WordIdx / BitsPerWord] |= uint64_t(1)
+                                        << (WordIdx % BitsPerWord);
     NumAllocated -= 1;
+}
+
+bool Slab::freeChunkRemote(void *Ptr) {
+    assert(Ptr >= getPtr() && Ptr < getEnd());
 
-    if (ChunkIdx < FirstFreeChunkIdx) {
-        FirstFreeChunkIdx = ChunkIdx;
+    auto ChunkIdx = bucket.getChunkIdx(static_cast<char *>(Ptr) -
+                                       static_cast<char *>(MemPtr));
+    uint64_t ChunkBit = uint64_t(1) << (ChunkIdx % BitsPerWord);
+
+    [[maybe_unused]] auto Prev = RemoteFreed[ChunkIdx / BitsPerWord].fetch_or(
+        ChunkBit, std::memory_order_release);
+    assert(!(Prev & ChunkBit) && "double free detected");
+
+    // Only the thread which finds the slab outside the list adds it.
+    return !InRemoteList.exchange(true, std::memory_order_acq_rel);
+}
+
+void Slab::reclaimRemoteFrees() {
+    // Chunks freed after this point add the slab to the list again. The
+    // chunks freed by threads which found it still in the list are visible
+    // below.
+    InRemoteList.exchange(false, std::memory_order_acq_rel);
+    takeRemoteFrees();
+}
+
+void Slab::takeRemoteFrees() {
+    size_t NumWords = numChunkWords(NumChunks);
+    for (size_t WordIdx = 0; WordIdx < NumWords; WordIdx++) {
+        if (!RemoteFreed[WordIdx].load(std::memory_order_relaxed)) {
+            continue;
+        }
+
+        auto Freed =
+            RemoteFreed[WordIdx].exchange(0, std::memory_order_acquire);
+        assert(!(Chunks[WordIdx] & Freed) && "double free detected");
+        Chunks[WordIdx] |= Freed;
+        FreeWords[WordIdx / BitsPerWord] |= uint64_t(1)
+                                            << (WordIdx % BitsPerWord);
+        for (; Freed; Freed &= Freed - 1) {
+            NumAllocated -= 1;
+        }
+    }
+}
+
+void *Slab::getChunkStart(void *Ptr) const {
+    auto ChunkIdx = bucket.getChunkIdx(static_cast<char *>(Ptr) -
+                                       static_cast<char *>(MemPtr));
+    return static_cast<char *>(MemPtr) + ChunkIdx * getChunkSize();
+}
+
+size_t Slab::getUsableSize(void *Ptr) {
+    if (bucket.isChunked()) {
+        return static_cast<char *>(getChunkStart(Ptr)) + getChunkSize() -
+               static_cast<char *>(Ptr);
     }
+    return static_cast<char *>(getEnd()) - static_cast<char *>(Ptr);
 }
 
 void *Slab::getEnd() const {
-    return static_cast<char *>(getPtr()) + bucket.SlabMinSize();
+    return static_cast<char *>(getPtr()) + SlabSize;
 }
 
 bool Slab::hasAvail() { return NumAllocated != getNumChunks(); }
 
 // If a slab was available in the pool then note that the current pooled
 // size has reduced by the size of a slab in this bucket.
-void Bucket::decrementPool(bool &FromPool) {
+void Bucket::decrementPool(Slab &Slab, bool &FromPool) {
     FromPool = true;
-    updateStats(1, -1);
-    OwnAllocCtx.getLimits()->TotalSize -= SlabAllocSize();
-}
-
-auto Bucket::getAvailFullSlab(bool &FromPool)
-    -> decltype(AvailableSlabs.begin()) {
-    // Return a slab that will be used for a single allocation.
-    if (AvailableSlabs.size() == 0) {
-        auto It = AvailableSlabs.insert(AvailableSlabs.begin(),
-                                        std::make_unique<Slab>(*this));
-        (*It)->setIterator(It);
-        FromPool = false;
-        updateStats(1, 0);
+    updateStats(1, -1, Slab.getSlabSize());
+    OwnAllocCtx.getLimits()->TotalSize -= Slab.getSlabSize();
+}
+
+Bucket::Bucket(size_t Sz, size_t Idx, DisjointPool::AllocImpl &AllocCtx)
+    : Size{Sz}, Idx{Idx}, TunedCapacity{AllocCtx.getParams().Capacity},
+      OwnAllocCtx{AllocCtx}, chunkedSlabsInPool(0), allocPoolCount(0),
+      freeCount(0), currSlabsInUse(0), currSlabsInPool(0), maxSlabsInPool(0),
+      allocCount(0), maxSlabsInUse(0) {
+    CurSlabSize = std::max(getSize(), SlabMinSize());
+    initChunkIdxReciprocal();
+}
+
+Bucket::~Bucket() {
+    destroySlabs(OwnedSlabs);
+    while (!AvailableSlabs.empty()) {
+        auto *Slab = AvailableSlabs.front();
+        // The limits may outlive the pool, even in other processes.
+        if (isPooled(*Slab)) {
+            OwnAllocCtx.getLimits()->TotalSize -= Slab->getSlabSize();
+        }
+        AvailableSlabs.remove(*Slab);
+        destroySlab(Slab);
+    }
+    while (!UnavailableSlabs.empty()) {
+        auto *Slab = UnavailableSlabs.front();
+        UnavailableSlabs.remove(*Slab);
+        destroySlab(Slab);
+    }
+
+    for (auto *SlabAllocator : SlabAllocators) {
+        if (SlabAllocator) {
+            umf_ba_destroy(SlabAllocator);
+        }
+    }
+}
+
+size_t Bucket::nextSlabSize() {
+    // All slabs are full, a chunked bucket needs larger ones.
+    if (isChunked() && AvailableSlabs.empty() &&
+        !UnavailableSlabs.empty()) {
+        CurSlabSize = std::min(CurSlabSize * 2, MaxSlabAllocSize());
+    }
+
+    return SlabAllocSize();
+}
+
+umf_result_t Bucket::createSlab(umf_ba_pool_t *SlabAllocator,
+                                size_t SlabSize, size_t Alignment,
+                                Slab *&NewSlab) {
+    // In case bucket size is not a multiple of SlabMinSize, we would have
+    // some padding at the end of the slab.
+    size_t NumChunks = SlabSize / getSize();
+
+    void *Mem = umf_ba_alloc(SlabAllocator);
+    if (!Mem) {
+        return UMF_RESULT_ERROR_OUT_OF_HOST_MEMORY;
+    }
+
+    NewSlab = new (Mem) Slab(*this, SlabSize, NumChunks);
+    auto Ret = NewSlab->init(Alignment);
+    if (Ret != UMF_RESULT_SUCCESS) {
+        umf_ba_free(SlabAllocator, Mem);
+        return Ret;
+    }
+
+    AllocatedSize.fetch_add(SlabSize, std::memory_order_relaxed);
+    return UMF_RESULT_SUCCESS;
+}
+
+size_t Bucket::refillCount(size_t SlabSize) {
+    size_t Count = OwnAllocCtx.getParams().SlabRefillCount;
+    if (Count <= 1 || !OwnAllocCtx.canSplit(SlabSize)) {
+        return 1;
+    }
+
+    // The slabs beyond the first one go to the pool, so there has to be
+    // room for them.
+    size_t Pooled =
+        isChunked() ? chunkedSlabsInPool : AvailableSlabs.size() + NumPurging;
+    size_t Room = Capacity() > Pooled ? Capacity() - Pooled : 0;
+
+    auto *Limits = OwnAllocCtx.getLimits();
+    size_t PoolSize = Limits->TotalSize;
+    if (Limits->MaxSize > PoolSize) {
+        Room = std::min(Room, (Limits->MaxSize - PoolSize) / SlabSize);
     } else {
-        decrementPool(FromPool);
+        Room = 0;
+    }
+
+    return std::min(Count, Room + 1);
+}
+
+umf_result_t Bucket::createSlabs(umf_ba_pool_t *SlabAllocator,
+                                 size_t SlabSize, size_t Count,
+                                 SlabList &NewSlabs) {
+    Slab *NewSlab;
+    void *Region;
+    size_t RegionSize = SlabSize * Count;
+    if (Count <= 1 || umfMemoryProviderAlloc(getMemHandle(), RegionSize, 0,
+                                             &Region) != UMF_RESULT_SUCCESS) {
+        auto Ret = createSlab(SlabAllocator, SlabSize, 0, NewSlab);
+        if (Ret == UMF_RESULT_SUCCESS) {
+            NewSlabs.push_front(*NewSlab);
+        }
+        return Ret;
+    }
+
+    // Split the slabs off the start of the region one by one. Each split
+    // also splits the region in the memory tracker.
+    size_t NumChunks = SlabSize / getSize();
+    auto *Ptr = static_cast<char *>(Region);
+    umf_result_t Ret = UMF_RESULT_SUCCESS;
+    bool Split = false;
+    while (RegionSize) {
+        Split = false;
+        if (RegionSize > SlabSize) {
+            Ret = umfMemoryProviderAllocationSplit(getMemHandle(), Ptr,
+                                                   RegionSize, SlabSize);
+            if (Ret != UMF_RESULT_SUCCESS) {
+                if (Ret == UMF_RESULT_ERROR_NOT_SUPPORTED) {
+                    OwnAllocCtx.onSplitNotSupported();
+                }
+                break;
+            }
+            Split = true;
+        }
+
+        void *Mem = umf_ba_alloc(SlabAllocator);
+        if (!Mem) {
+            Ret = UMF_RESULT_ERROR_OUT_OF_HOST_MEMORY;
+            break;
+        }
+
+        NewSlab = new (Mem) Slab(*this, SlabSize, NumChunks);
+        Ret = NewSlab->attach(Ptr);
+        if (Ret != UMF_RESULT_SUCCESS) {
+            umf_ba_free(SlabAllocator, Mem);
+            break;
+        }
+
+        AllocatedSize.fetch_add(SlabSize, std::memory_order_relaxed);
+        NewSlabs.push_front(*NewSlab);
+        Ptr += SlabSize;
+        RegionSize -= SlabSize;
+    }
+
+    // Return the part of the region without slabs to the provider.
+    if (RegionSize) {
+        if (Split) {
+            umfMemoryProviderFree(getMemHandle(), Ptr, SlabSize);
+            Ptr += SlabSize;
+            RegionSize -= SlabSize;
+        }
+        umfMemoryProviderFree(getMemHandle(), Ptr, RegionSize);
+    }
+
+    if (NewSlabs.empty()) {
+        return createSlabs(SlabAllocator, SlabSize, 1, NewSlabs);
+    }
+    return UMF_RESULT_SUCCESS;
+}
+
+Slab *Bucket::publishSlabs(SlabList &NewSlabs, SlabList &ToDestroy) {
+    while (NewSlabs.size() > 1) {
+        auto *Slab = NewSlabs.front();
+        updateStats(1, 0, Slab->getSlabSize());
+
+        bool ToPool;
+        if (CanPool(*Slab, ToPool)) {
+            moveSlab(*Slab, NewSlabs, AvailableSlabs);
+            onSlabPooled(*Slab);
+        } else {
+            moveSlab(*Slab, NewSlabs, ToDestroy);
+        }
+    }
+
+    auto *Slab = NewSlabs.front();
+    NewSlabs.remove(*Slab);
+    updateStats(1, 0, Slab->getSlabSize());
+    return Slab;
+}
+
+bool Bucket::stealSlab(SlabList &NewSlabs) {
+    for (auto *Shard = NextShard; Shard != this; Shard = Shard->NextShard) {
+        void *Mem;
+        size_t SlabSize;
+        if (!Shard->giveSlab(Mem, SlabSize)) {
+            continue;
+        }
+
+        if (attachSlab(Mem, SlabSize, NewSlabs)) {
+            return true;
+        }
+
+        auto Ret = umfMemoryProviderFree(getMemHandle(), Mem, SlabSize);
+        if (Ret != UMF_RESULT_SUCCESS) {
+            printProviderError(Ret);
+        }
+        return false;
+    }
+    return false;
+}
+
+bool Bucket::attachSlab(void *Mem, size_t SlabSize, SlabList &NewSlabs) {
+    umf_ba_pool_t *SlabAllocator;
+    {
+        std::lock_guard<std::mutex> Lg(BucketLock);
+        SlabAllocator = getSlabAllocator(SlabSize);
+    }
+
+    void *ObjMem = SlabAllocator ? umf_ba_alloc(SlabAllocator) : nullptr;
+    if (!ObjMem) {
+        return false;
+    }
+
+    // A whole slab is a single chunk, whatever its size.
+    size_t NumChunks = isChunked() ? SlabSize / getSize() : 1;
+    auto *NewSlab = new (ObjMem) Slab(*this, SlabSize, NumChunks);
+    if (NewSlab->attach(Mem, true) != UMF_RESULT_SUCCESS) {
+        umf_ba_free(SlabAllocator, ObjMem);
+        return false;
+    }
+
+    AllocatedSize.fetch_add(SlabSize, std::memory_order_relaxed);
+    NewSlabs.push_front(*NewSlab);
+    return true;
+}
+
+void Bucket::poolSlab(void *Mem, size_t SlabSize) {
+    SlabList NewSlabs;
+    if (!attachSlab(Mem, SlabSize, NewSlabs)) {
+        auto Ret = umfMemoryProviderFree(getMemHandle(), Mem, SlabSize);
+        if (Ret != UMF_RESULT_SUCCESS) {
+            printProviderError(Ret);
+        }
+        return;
+    }
+
+    auto *Slab = NewSlabs.front();
+    {
+        std::lock_guard<std::mutex> Lg(BucketLock);
+        updateStats(1, 0, SlabSize);
+
+        bool ToPool;
+        if (CanPool(*Slab, ToPool)) {
+            moveSlab(*Slab, NewSlabs, AvailableSlabs);
+            onSlabPooled(*Slab);
+            return;
+        }
+        NewSlabs.remove(*Slab);
+    }
+
+    destroySlab(Slab);
+}
+
+void Bucket::poolRegion(void *Mem, size_t Size) {
+    // Each bucket takes as many slabs as fit, from the largest down.
+    auto *Ptr = static_cast<char *>(Mem);
+    auto *Bucket = this;
+    while (Size && Bucket && !Bucket->isChunked()) {
+        size_t SlabSize = Bucket->SlabAllocSize();
+        bool Fits = SlabSize == Size ||
+                    (SlabSize < Size && OwnAllocCtx.canSplit(Size) &&
+                     OwnAllocCtx.canSplit(SlabSize));
+        if (!Fits) {
+            Bucket = Bucket->Smaller;
+            continue;
+        }
+
+        if (SlabSize < Size) {
+            auto Ret = umfMemoryProviderAllocationSplit(getMemHandle(), Ptr,
+                                                        Size, SlabSize);
+            if (Ret != UMF_RESULT_SUCCESS) {
+                if (Ret == UMF_RESULT_ERROR_NOT_SUPPORTED) {
+                    OwnAllocCtx.onSplitNotSupported();
+                }
+                break;
+            }
+        }
+
+        Bucket->poolSlab(Ptr, SlabSize);
+        Ptr += SlabSize;
+        Size -= SlabSize;
+    }
+
+    if (Size) {
+        auto Ret = umfMemoryProviderFree(getMemHandle(), Ptr, Size);
+        if (Ret != UMF_RESULT_SUCCESS) {
+            printProviderError(Ret);
+        }
     }
+}
+
+bool Bucket::reuseSlab(SlabList &NewSlabs) {
+    if (!OwnAllocCtx.getParams().ReuseLargerSlabs || isChunked()) {
+        return false;
+    }
+
+    // Without splitting, a slab is reused only if less than half of it is
+    // wasted.
+    size_t SlabSize = SlabAllocSize();
+    bool CanSplit = OwnAllocCtx.canSplit(SlabSize);
+    size_t MaxSize = CanSplit ? (std::numeric_limits<size_t>::max)()
+                              : SlabSize * 2 - 1;
+
+    // The smallest larger slab fits best. The slab sizes grow with the
+    // bucket sizes, and buckets above MaxPoolableSize are not used.
+    void *Mem = nullptr;
+    size_t Size = 0;
+    Bucket *From = nullptr;
+    for (auto *Bucket = Larger;
+         Bucket && Bucket->getSize() <= MaxPoolableSize() &&
+         Bucket->SlabAllocSize() <= MaxSize;
+         Bucket = Bucket->Larger) {
+        if (Bucket->currSlabsInPool.load(std::memory_order_relaxed) &&
+            Bucket->giveSlab(Mem, Size, MaxSize)) {
+            From = Bucket;
+            break;
+        }
+    }
+
+    if (!From && OwnAllocCtx.canMerge()) {
+        for (auto *Bucket = Smaller; Bucket && !Bucket->isChunked();
+             Bucket = Bucket->Smaller) {
+            if (Bucket->currSlabsInPool.load(std::memory_order_relaxed) > 1 &&
+                Bucket->giveMergedSlabs(SlabSize, MaxSize, Mem, Size)) {
+                From = Bucket;
+                break;
+            }
+        }
+    }
+
+    if (!From) {
+        return false;
+    }
+
+    // The excess goes back to the pool, unless the slab can be used whole.
+    if (Size > SlabSize && CanSplit && OwnAllocCtx.canSplit(Size)) {
+        auto Ret = umfMemoryProviderAllocationSplit(getMemHandle(), Mem, Size,
+                                                    SlabSize);
+        if (Ret == UMF_RESULT_SUCCESS) {
+            From->poolRegion(static_cast<char *>(Mem) + SlabSize,
+                            Size - SlabSize);
+            Size = SlabSize;
+        } else if (Ret == UMF_RESULT_ERROR_NOT_SUPPORTED) {
+            OwnAllocCtx.onSplitNotSupported();
+        }
+    }
+
+    // A region which can't be used goes back in slabs of the bucket it came
+    // from, merged slabs are not pooled as a single oversized one.
+    if (Size >= SlabSize * 2) {
+        From->poolRegion(Mem, Size);
+        return false;
+    }
+
+    if (!attachSlab(Mem, Size, NewSlabs)) {
+        From->poolRegion(Mem, Size);
+        return false;
+    }
+    return true;
+}
+
+Slab *Bucket::nextPooledSlab(Slab &Slab) {
+    auto *Next = static_cast<class Slab *>(
+        critnib_get(OwnAllocCtx.getKnownSlabs(),
+                    reinterpret_cast<uintptr_t>(Slab.getEnd())));
+    if (!Next || !AvailableSlabs.contains(*Next) || !isPooled(*Next)) {
+        return nullptr;
+    }
+    return Next;
+}
+
+bool Bucket::giveMergedSlabs(size_t MinSize, size_t MaxSize, void *&Mem,
+                             size_t &Size) {
+    SlabList Given;
+    {
+        std::lock_guard<std::mutex> Lg(BucketLock);
+
+        // Find the first run of adjacent pooled slabs which is large enough,
+        // following each slab to the one right after it in the slab map.
+        Slab *First = nullptr;
+        size_t RunSize = 0;
+        for (auto *Slab = AvailableSlabs.front(); Slab && RunSize < MinSize;
+             Slab = Slab->getNext()) {
+            if (!isPooled(*Slab)) {
+                continue;
+            }
+            First = Slab;
+            RunSize = Slab->getSlabSize();
+            for (auto *Last = Slab; RunSize < MinSize;) {
+                Last = nextPooledSlab(*Last);
+                if (!Last) {
+                    break;
+                }
+                RunSize += Last->getSlabSize();
+            }
+        }
+        if (RunSize < MinSize || RunSize > MaxSize) {
+            return false;
+        }
+
+        // Given ends up in reverse address order.
+        for (size_t Taken = 0; Taken < RunSize;) {
+            auto *Next = nextPooledSlab(*First);
+            Taken += First->getSlabSize();
+            unpoolSlab(*First, Given);
+            First = Next;
+        }
+    }
+
+    // The slabs are merged one by one, from the highest address down. The
+    // ones which could not be merged go back to the pool.
+    auto *Last = Given.front();
+    Given.remove(*Last);
+    Size = Last->getSlabSize();
+    Mem = Last->detach();
+    destroySlab(Last);
+    while (!Given.empty()) {
+        auto *Prev = Given.front();
+        size_t PrevSize = Prev->getSlabSize();
+        auto Ret = umfMemoryProviderAllocationMerge(
+            getMemHandle(), Prev->getPtr(), Mem, PrevSize + Size);
+        if (Ret != UMF_RESULT_SUCCESS) {
+            if (Ret == UMF_RESULT_ERROR_NOT_SUPPORTED) {
+                OwnAllocCtx.onMergeNotSupported();
+            }
+            break;
+        }
+        Given.remove(*Prev);
+        Mem = Prev->detach();
+        destroySlab(Prev);
+        Size += PrevSize;
+    }
+    if (Given.empty()) {
+        return true;
+    }
+
+    poolRegion(Mem, Size);
+    while (!Given.empty()) {
+        auto *Prev = Given.front();
+        Given.remove(*Prev);
+        size_t PrevSize = Prev->getSlabSize();
+        void *PrevMem = Prev->detach();
+        destroySlab(Prev);
+        poolSlab(PrevMem, PrevSize);
+    }
+    return false;
+}
+
+bool Bucket::giveSlab(void *&Mem, size_t &SlabSize, size_t MaxSlabSize) {
+    SlabList Given;
+    {
+        std::lock_guard<std::mutex> Lg(BucketLock);
+        if (!isChunked() || chunkedSlabsInPool) {
+            for (auto *Slab = AvailableSlabs.front(); Slab;
+                 Slab = Slab->getNext()) {
+                if (isPooled(*Slab) && Slab->getSlabSize() <= MaxSlabSize) {
+                    unpoolSlab(*Slab, Given);
+                    break;
+                }
+            }
+        }
+        if (Given.empty()) {
+            return false;
+        }
+    }
+
+    auto *Slab = Given.front();
+    Given.remove(*Slab);
+    SlabSize = Slab->getSlabSize();
+    Mem = Slab->detach();
+    destroySlab(Slab);
+    return true;
+}
 
-    return AvailableSlabs.begin();
+void Bucket::unpoolSlab(Slab &Slab, SlabList &To) {
+    moveSlab(Slab, AvailableSlabs, To);
+    if (isChunked()) {
+        --chunkedSlabsInPool;
+    }
+    updateStats(0, -1, Slab.getSlabSize());
+    OwnAllocCtx.getLimits()->TotalSize -= Slab.getSlabSize();
 }
 
-void *Bucket::getSlab(bool &FromPool) {
+void Bucket::collectPooled(OldestPooledSlabs &Oldest) {
     std::lock_guard<std::mutex> Lg(BucketLock);
+    for (auto *Slab = AvailableSlabs.front(); Slab; Slab = Slab->getNext()) {
+        if (isPooled(*Slab)) {
+            Oldest.add(Slab->getPooledSince(), Slab->getSlabSize());
+        }
+    }
+}
+
+size_t Bucket::trimPooled(uint64_t PooledBefore, size_t MaxSize) {
+    SlabList ToDestroy;
+    size_t Freed = 0;
+    {
+        std::lock_guard<std::mutex> Lg(BucketLock);
+        for (auto *Slab = AvailableSlabs.front(); Slab && Freed < MaxSize;) {
+            auto *Next = Slab->getNext();
+            if (isPooled(*Slab) && Slab->getPooledSince() <= PooledBefore) {
+                Freed += Slab->getSlabSize();
+                unpoolSlab(*Slab, ToDestroy);
+            }
+            Slab = Next;
+        }
+    }
+
+    destroySlabs(ToDestroy);
+    return Freed;
+}
+
+void Bucket::destroySlab(Slab *Slab) {
+    size_t SlabSize = Slab->getSlabSize();
+    Slab->~Slab();
+    umf_ba_free(SlabAllocators[getSlabAllocatorIdx(SlabSize)], Slab);
+    AllocatedSize.fetch_sub(SlabSize, std::memory_order_relaxed);
+}
+
+void Bucket::destroySlabs(SlabList &Slabs) {
+    while (!Slabs.empty()) {
+        auto *Slab = Slabs.front();
+        Slabs.remove(*Slab);
+        destroySlab(Slab);
+    }
+}
+
+size_t Bucket::getSlabAllocatorIdx(size_t SlabSize) {
+    return getLeftmostSetBitPos(SlabSize /
+                                std::max(getSize(), SlabMinSize()));
+}
+
+umf_ba_pool_t *Bucket::getSlabAllocator(size_t SlabSize) {
+    auto &SlabAllocator = SlabAllocators[getSlabAllocatorIdx(SlabSize)];
+    if (!SlabAllocator) {
+        SlabAllocator = umf_ba_create(Slab::allocSize(SlabSize / getSize()));
+    }
+    return SlabAllocator;
+}
+
+Slab *Bucket::getAvailFullSlab(size_t Alignment) {
+    // Return a slab that will be used for a single allocation. Any pooled
+    // slab is aligned to the provider page, larger alignments are only met
+    // by the slabs which happen to be aligned.
+    auto *Slab = AvailableSlabs.front();
+    if (Alignment) {
+        while (Slab && (reinterpret_cast<uintptr_t>(Slab->getPtr()) &
+                        (Alignment - 1))) {
+            Slab = Slab->getNext();
+        }
+    }
+
+    return Slab;
+}
+
+umf_result_t Bucket::getSlab(void **Ptr, bool &FromPool, bool &Zeroed,
+                             size_t Alignment) {
+    size_t SlabSize;
+    size_t Count;
+    umf_ba_pool_t *SlabAllocator;
+    {
+        std::lock_guard<std::mutex> Lg(BucketLock);
+
+        auto *Slab = getAvailFullSlab(Alignment);
+        if (Slab) {
+            decrementPool(*Slab, FromPool);
+            moveSlab(*Slab, AvailableSlabs, UnavailableSlabs);
+            Zeroed = false;
+            *Ptr = Slab->getSlab();
+            return UMF_RESULT_SUCCESS;
+        }
+
+        SlabSize = nextSlabSize();
+        Count = Alignment ? 1 : refillCount(SlabSize);
+        SlabAllocator = getSlabAllocator(SlabSize);
+        if (!SlabAllocator) {
+            return UMF_RESULT_ERROR_OUT_OF_HOST_MEMORY;
+        }
+    }
+
+    // The provider is called without the lock, so that it doesn't stall
+    // other threads using this bucket. A pooled slab of another shard, or
+    // of another size, is taken first if there is one.
+    umf_result_t Ret = UMF_RESULT_SUCCESS;
+    SlabList NewSlabs;
+    bool Stolen = !Alignment && (stealSlab(NewSlabs) || reuseSlab(NewSlabs));
+    if (Alignment) {
+        Slab *NewSlab;
+        Ret = createSlab(SlabAllocator, SlabSize, Alignment, NewSlab);
+        if (Ret == UMF_RESULT_SUCCESS) {
+            NewSlabs.push_front(*NewSlab);
+        }
+    } else if (!Stolen) {
+        Ret = createSlabs(SlabAllocator, SlabSize, Count, NewSlabs);
+    }
+    if (Ret != UMF_RESULT_SUCCESS) {
+        return Ret;
+    }
+
+    Slab *NewSlab;
+    SlabList ToDestroy;
+    {
+        std::lock_guard<std::mutex> Lg(BucketLock);
+        NewSlab = publishSlabs(NewSlabs, ToDestroy);
+        UnavailableSlabs.push_front(*NewSlab);
+    }
+    destroySlabs(ToDestroy);
 
-    auto SlabIt = getAvailFullSlab(FromPool);
-    auto *FreeSlab = (*SlabIt)->getSlab();
-    auto It =
-        UnavailableSlabs.insert(UnavailableSlabs.begin(), std::move(*SlabIt));
-    AvailableSlabs.erase(SlabIt);
-    (*It)->setIterator(It);
-    return FreeSlab;
+    // Only a new slab holds memory which has never been used
+    FromPool = Stolen;
+    Zeroed = !Stolen && isProviderMemoryZeroed();
+    *Ptr = NewSlab->getSlab();
+    return UMF_RESULT_SUCCESS;
 }
 
 void Bucket::freeSlab(Slab &Slab, bool &ToPool) {
-    std::lock_guard<std::mutex> Lg(BucketLock);
-    auto SlabIter = Slab.getIterator();
-    assert(SlabIter != UnavailableSlabs.end());
-    if (CanPool(ToPool)) {
-        auto It =
-            AvailableSlabs.insert(AvailableSlabs.begin(), std::move(*SlabIter));
-        UnavailableSlabs.erase(SlabIter);
-        (*It)->setIterator(It);
+    {
+        std::lock_guard<std::mutex> Lg(BucketLock);
+        if (CanPool(Slab, ToPool)) {
+            moveSlab(Slab, UnavailableSlabs, AvailableSlabs);
+            onSlabPooled(Slab);
+            return;
+        }
+        UnavailableSlabs.remove(Slab);
+    }
+
+    destroySlab(&Slab);
+}
+
+Slab *Bucket::getAvailSlab(bool &FromPool) {
+    if (AvailableSlabs.empty()) {
+        return nullptr;
+    }
+
+    auto *Front = AvailableSlabs.front();
+    if (Front->getNumAllocated() == 0 && !Front->isInRemoteList()) {
+        // If this was an empty slab, it was in the pool.
+        // Now it is no longer in the pool, so update count.
+        --chunkedSlabsInPool;
+        decrementPool(*Front, FromPool);
     } else {
-        UnavailableSlabs.erase(SlabIter);
+        // Allocation from existing slab is treated as from pool for statistics.
+        FromPool = true;
+    }
+
+    return Front;
+}
+
+template <typename WithSlabFn>
+umf_result_t Bucket::withAvailSlab(bool &FromPool, WithSlabFn &&WithSlab) {
+    SlabList NewSlabs;
+    bool Stolen = false;
+    while (true) {
+        SlabList ToDestroy;
+        size_t SlabSize = 0;
+        size_t Count = 0;
+        umf_ba_pool_t *SlabAllocator = nullptr;
+        bool NeedSlab = false;
+        {
+            std::lock_guard<std::mutex> Lg(BucketLock);
+            takeOwnership(ToDestroy);
+
+            Slab *ChunkSlab = nullptr;
+            if (!NewSlabs.empty()) {
+                // Publish the slabs allocated without the lock. Other threads
+                // may have added slabs in the meantime, which is fine.
+                ChunkSlab = publishSlabs(NewSlabs, ToDestroy);
+                AvailableSlabs.push_front(*ChunkSlab);
+                FromPool = Stolen;
+            } else {
+                ChunkSlab = getAvailSlab(FromPool);
+            }
+
+            if (ChunkSlab) {
+                WithSlab(*ChunkSlab);
+            } else {
+                NeedSlab = true;
+                SlabSize = nextSlabSize();
+                Count = refillCount(SlabSize);
+                SlabAllocator = getSlabAllocator(SlabSize);
+            }
+        }
+
+        destroySlabs(ToDestroy);
+        if (!NeedSlab) {
+            return UMF_RESULT_SUCCESS;
+        }
+        if (!SlabAllocator) {
+            return UMF_RESULT_ERROR_OUT_OF_HOST_MEMORY;
+        }
+
+        // Take a pooled slab of another shard or allocate new slabs without
+        // the lock, and retry with them.
+        Stolen = stealSlab(NewSlabs);
+        if (Stolen) {
+            continue;
+        }
+        auto Ret = createSlabs(SlabAllocator, SlabSize, Count, NewSlabs);
+        if (Ret != UMF_RESULT_SUCCESS) {
+            return Ret;
+        }
+    }
+}
+
+umf_result_t Bucket::getChunk(void **Ptr, bool &FromPool, bool &Zeroed) {
+    return withAvailSlab(
+        FromPool, [&](Slab &Slab) { *Ptr = takeChunk(Slab, Zeroed); });
+}
+
+umf_result_t Bucket::getChunks(CachedChunk *Chunks, size_t Count,
+                               size_t &NumChunks, bool &FromPool) {
+    NumChunks = 0;
+    return withAvailSlab(FromPool, [&](Slab &Slab) {
+        Chunks[0].OwnerSlab = &Slab;
+        Chunks[0].Ptr = takeChunk(Slab, Chunks[0].Zeroed);
+
+        // Take the rest only from already allocated slabs
+        for (NumChunks = 1; NumChunks < Count; ++NumChunks) {
+            bool ChunkFromPool;
+            auto *ChunkSlab = getAvailSlab(ChunkFromPool);
+            if (!ChunkSlab) {
+                break;
+            }
+            Chunks[NumChunks].OwnerSlab = ChunkSlab;
+            Chunks[NumChunks].Ptr =
+                takeChunk(*ChunkSlab, Chunks[NumChunks].Zeroed);
+        }
+    });
+}
+
+// The lock must be acquired before calling this method
+void *Bucket::takeChunk(Slab &ChunkSlab, bool &Zeroed) {
+    auto *FreeChunk = ChunkSlab.getChunk(Zeroed);
+
+    // If the slab is full, move it to unavailable slabs
+    if (!ChunkSlab.hasAvail()) {
+        moveSlab(ChunkSlab, AvailableSlabs, UnavailableSlabs);
     }
+
+    return FreeChunk;
 }
 
-auto Bucket::getAvailSlab(bool &FromPool) -> decltype(AvailableSlabs.begin()) {
+void Bucket::freeChunk(void *Ptr, Slab &Slab, bool &ToPool) {
+    if (isRemoteFree()) {
+        freeChunkRemote(Ptr, Slab);
+        // The chunk stays in its slab until it is reclaimed.
+        ToPool = true;
+        return;
+    }
+
+    SlabList ToDestroy;
+    {
+        std::lock_guard<std::mutex> Lg(BucketLock);
+
+        bool WasFull = !Slab.hasAvail();
+        Slab.freeChunk(Ptr);
+
+        onFreeChunk(Slab, WasFull, ToPool, ToDestroy);
+    }
+
+    destroySlabs(ToDestroy);
+}
+
+void Bucket::freeChunks(const CachedChunk *Chunks, size_t Count,
+                        bool &ToPool) {
+    SlabList ToDestroy;
+    {
+        std::lock_guard<std::mutex> Lg(BucketLock);
+
+        for (size_t i = 0; i < Count; i++) {
+            assert(&Chunks[i].OwnerSlab->getBucket() == this);
+            bool WasFull = !Chunks[i].OwnerSlab->hasAvail();
+            Chunks[i].OwnerSlab->freeChunk(Chunks[i].Ptr);
+            onFreeChunk(*Chunks[i].OwnerSlab, WasFull, ToPool, ToDestroy);
+        }
+    }
+
+    destroySlabs(ToDestroy);
+}
+
+// Address of a thread-local variable, unique for each running thread
+static const void *getThreadToken() {
+    static thread_local char Token;
+    return &Token;
+}
+
+bool Bucket::isRemoteFree() {
+    return OwnAllocCtx.getParams().RemoteFreeQueues &&
+           Owner.load(std::memory_order_relaxed) != getThreadToken();
+}
+
+void Bucket::freeChunkRemote(void *Ptr, Slab &Slab) {
+    // The chunk can be reclaimed as soon as its bit is set, keep the slab
+    // alive until it is in the list.
+    Slab.RemoteFreesInFlight.fetch_add(1, std::memory_order_relaxed);
+    if (Slab.freeChunkRemote(Ptr)) {
+        pushRemoteFreeSlab(Slab);
+    }
+    Slab.RemoteFreesInFlight.fetch_sub(1, std::memory_order_release);
+}
+
+void Bucket::pushRemoteFreeSlab(Slab &Slab) {
+    auto *Head = RemoteFreeSlabs.load(std::memory_order_relaxed);
+    do {
+        Slab.RemoteNext = Head;
+    } while (!RemoteFreeSlabs.compare_exchange_weak(
+        Head, &Slab, std::memory_order_release, std::memory_order_relaxed));
+}
+
+void Bucket::takeOwnership(SlabList &ToDestroy) {
+    auto &Params = OwnAllocCtx.getParams();
+    if (Params.ThreadOwnedSlabs) {
+        reclaimRemoteFrees(ToDestroy);
+        return;
+    }
+    if (!Params.RemoteFreeQueues) {
+        return;
+    }
+
+    // Frees of the owner take the lock, like without remote-free queues.
+    Owner.store(getThreadToken(), std::memory_order_relaxed);
+    reclaimRemoteFrees(ToDestroy);
+}
+
+umf_result_t Bucket::getOwnedChunk(Slab *&Owned, void **Ptr, bool &FromPool,
+                                   bool &Zeroed) {
+    if (Owned) {
+        // Chunks freed by other threads are reused once the slab is full.
+        if (!Owned->hasAvail()) {
+            Owned->takeRemoteFrees();
+        }
+        if (Owned->hasAvail()) {
+            FromPool = true;
+            *Ptr = Owned->getChunk(Zeroed);
+            return UMF_RESULT_SUCCESS;
+        }
+
+        // The slab may belong to another shard of this size.
+        Owned->getBucket().releaseSlab(*Owned);
+        Owned = nullptr;
+    }
+
+    return withAvailSlab(FromPool, [&](Slab &Slab) {
+        moveSlab(Slab, AvailableSlabs, OwnedSlabs);
+        Slab.Owner.store(getThreadToken(), std::memory_order_relaxed);
+        Owned = &Slab;
+        *Ptr = Slab.getChunk(Zeroed);
+    });
+}
+
+void Bucket::freeOwnedChunk(void *Ptr, Slab &Slab, bool &ToPool) {
+    ToPool = true;
+
+    // Only the owner itself gives an owned slab back.
+    auto *Owner = Slab.getOwner();
+    if (Owner == getThreadToken()) {
+        Slab.freeChunk(Ptr);
+        return;
+    }
+
+    // Chunks of slabs owned by other threads are queued, the owner reuses
+    // them or they are reclaimed under the lock once the slab is given back.
+    if (Owner) {
+        freeChunkRemote(Ptr, Slab);
+        return;
+    }
+
+    SlabList ToDestroy;
+    {
+        std::lock_guard<std::mutex> Lg(BucketLock);
+
+        // Another thread may have taken the slab before the lock.
+        if (Slab.getOwner()) {
+            freeChunkRemote(Ptr, Slab);
+            return;
+        }
+
+        bool WasFull = !Slab.hasAvail();
+        Slab.freeChunk(Ptr);
+        onFreeChunk(Slab, WasFull, ToPool, ToDestroy);
+    }
+
+    destroySlabs(ToDestroy);
+}
+
+void Bucket::releaseSlab(Slab &Slab) {
+    SlabList ToDestroy;
+    {
+        std::lock_guard<std::mutex> Lg(BucketLock);
+        Slab.Owner.store(nullptr, std::memory_order_relaxed);
+        Slab.takeRemoteFrees();
+
+        OwnedSlabs.remove(Slab);
+        if (Slab.hasAvail()) {
+            AvailableSlabs.push_front(Slab);
+        } else {
+            UnavailableSlabs.push_front(Slab);
+        }
+
+        // If the slab is in the remote-free list, it is handled with the
+        // rest of the list.
+        bool ToPool;
+        onFreeChunk(Slab, false, ToPool, ToDestroy);
+        reclaimRemoteFrees(ToDestroy);
+    }
+
+    destroySlabs(ToDestroy);
+}
+
+void Bucket::reclaimRemoteFrees(SlabList &ToDestroy) {
+    if (!RemoteFreeSlabs.load(std::memory_order_relaxed)) {
+        return;
+    }
+
+    auto *Slab = RemoteFreeSlabs.exchange(nullptr, std::memory_order_acquire);
+    while (Slab) {
+        // The slab can be added to the list again once it is reclaimed.
+        auto *Next = Slab->RemoteNext;
+
+        // The chunks of an owned slab are left to its owner.
+        if (Slab->getOwner()) {
+            Slab->InRemoteList.store(false, std::memory_order_release);
+            Slab = Next;
+            continue;
+        }
+
+        bool WasFull = !Slab->hasAvail();
+        Slab->reclaimRemoteFrees();
+
+        bool ToPool;
+        onFreeChunk(*Slab, WasFull, ToPool, ToDestroy);
+
+        Slab = Next;
+    }
+}
+
+// The lock must be acquired before calling this method
+void Bucket::onFreeChunk(Slab &Slab, bool WasFull, bool &ToPool,
+                         SlabList &ToDestroy) {
+    ToPool = true;
+
+    // In case if the slab was previously full and now has available
+    // chunks, it should be moved to the list of available slabs
+    if (WasFull && Slab.hasAvail()) {
+        moveSlab(Slab, UnavailableSlabs, AvailableSlabs);
+    }
+
+    // Check if slab is empty, and pool it if we can. A slab still in the
+    // remote-free list is handled once it is reclaimed.
+    if (Slab.getNumAllocated() == 0) {
+        // Remote frees are checked first, the ones done since then have
+        // added the slab to the list.
+        bool InFlight = Slab.hasRemoteFreesInFlight();
+        if (Slab.isInRemoteList()) {
+            return;
+        }
+
+        // A remote free of the last chunk may not be done with the slab
+        // yet, it is handled with the remote-free list instead.
+        if (InFlight) {
+            if (!Slab.InRemoteList.exchange(true, std::memory_order_acq_rel)) {
+                pushRemoteFreeSlab(Slab);
+            }
+            return;
+        }
+
+        // The slab is now empty.
+        // If pool has capacity then put the slab in the pool.
+        // The ToPool parameter indicates whether the Slab will be put in the
+        // pool or freed, which is done by the caller without the lock.
+        if (CanPool(Slab, ToPool)) {
+            onSlabPooled(Slab);
+        } else {
+            moveSlab(Slab, AvailableSlabs, ToDestroy);
+        }
+
+        // The bucket is cold, new slabs can be smaller.
+        if (!currSlabsInUse.load(std::memory_order_relaxed)) {
+            CurSlabSize =
+                std::max(CurSlabSize / 2, std::max(getSize(), SlabMinSize()));
+        }
+    }
+}
+
+void Bucket::onSlabPooled(Slab &Slab) {
+    auto &Params = OwnAllocCtx.getParams();
+    if (Params.PurgeDecayMs || Params.FreeDecayMs ||
+        OwnAllocCtx.getLimits()->SoftMaxSize.load(std::memory_order_relaxed)) {
+        Slab.markPooled(getTimeMs());
+    }
+}
+
+void Bucket::decay(uint64_t Now) {
+    auto &Params = OwnAllocCtx.getParams();
+
+    // Slabs are freed and purged without the lock. Slabs being purged are
+    // taken out of the available list meanwhile, but stay in the pool.
+    SlabList ToDestroy;
+    SlabList ToPurge;
+    {
+        std::lock_guard<std::mutex> Lg(BucketLock);
+        reclaimRemoteFrees(ToDestroy);
+
+        // Entirely free slabs in the available list are the ones in the pool.
+        for (auto *Slab = AvailableSlabs.front(); Slab;) {
+            auto *Next = Slab->getNext();
+
+            if (isPooled(*Slab)) {
+                // The slab may have been pooled after Now was taken.
+                auto PooledSince = Slab->getPooledSince();
+                auto IdleTime = Now > PooledSince ? Now - PooledSince : 0;
+                if (Params.FreeDecayMs && IdleTime >= Params.FreeDecayMs) {
+                    unpoolSlab(*Slab, ToDestroy);
+                } else if (Params.PurgeDecayMs &&
+                           IdleTime >= Params.PurgeDecayMs &&
+                           !Slab->isPurged()) {
+                    moveSlab(*Slab, AvailableSlabs, ToPurge);
+                }
+            }
+
+            Slab = Next;
+        }
+        NumPurging += ToPurge.size();
+    }
+
+    destroySlabs(ToDestroy);
+    if (ToPurge.empty()) {
+        return;
+    }
+
+    for (auto *Slab = ToPurge.front(); Slab; Slab = Slab->getNext()) {
+        Slab->purge();
+    }
+
+    std::lock_guard<std::mutex> Lg(BucketLock);
+    while (!ToPurge.empty()) {
+        moveSlab(*ToPurge.front(), ToPurge, AvailableSlabs);
+        --NumPurging;
+    }
+}
+
+size_t Bucket::tune() {
+    auto AllocCount = allocCount.load(std::memory_order_relaxed);
+    auto AllocPoolCount = allocPoolCount.load(std::memory_order_relaxed);
+    size_t Allocs = AllocCount - TuneAllocCount;
+    size_t Misses = Allocs - (AllocPoolCount - TuneAllocPoolCount);
+    TuneAllocCount = AllocCount;
+    TuneAllocPoolCount = AllocPoolCount;
+
+    // Buckets of chunks always keep a single slab in the pool.
+    if (isChunked()) {
+        return Allocs;
+    }
+
+    SlabList ToDestroy;
+    {
+        std::lock_guard<std::mutex> Lg(BucketLock);
+        size_t PeakInUse = TuneMaxSlabsInUse;
+        size_t MinInPool = TuneMinSlabsInPool;
+        TuneMaxSlabsInUse = currSlabsInUse.load(std::memory_order_relaxed);
+        TuneMinSlabsInPool = currSlabsInPool.load(std::memory_order_relaxed);
+
+        // Grow while a significant part of the allocations needs new slabs,
+        // keeping up to the slabs which were in use at the same time. Shrink
+        // by half of the slabs which stayed in the pool the whole time.
+        size_t Cap = TunedCapacity.load(std::memory_order_relaxed);
+        if (Misses && Misses * AutoTuneMissRatio >= Allocs) {
+            Cap = std::max(Cap, std::min(std::max(Cap * 2, size_t(1)),
+                                         PeakInUse));
+        } else if (MinInPool) {
+            Cap -= std::min(Cap, (MinInPool + 1) / 2);
+        }
+        Cap = std::max(Cap, size_t(1));
+        Cap = std::min(Cap, OwnAllocCtx.getLimits()->MaxSize / SlabAllocSize());
+        TunedCapacity.store(Cap, std::memory_order_relaxed);
+
+        // Return the pooled slabs above the new capacity to the provider.
+        while (AvailableSlabs.size() + NumPurging > Cap &&
+               !AvailableSlabs.empty()) {
+            unpoolSlab(*AvailableSlabs.front(), ToDestroy);
+        }
+    }
+
+    destroySlabs(ToDestroy);
+    return Allocs;
+}
+
+bool Bucket::CanPool(Slab &Slab, bool &ToPool) {
+    size_t NewFreeSlabsInBucket;
+    // Check if this bucket is used in chunked form or as full slabs.
+    bool chunkedBucket = isChunked();
+    if (chunkedBucket) {
+        NewFreeSlabsInBucket = chunkedSlabsInPool + 1;
+    } else {
+        NewFreeSlabsInBucket = AvailableSlabs.size() + NumPurging + 1;
+    }
+    if (Capacity() >= NewFreeSlabsInBucket) {
+        size_t PoolSize = OwnAllocCtx.getLimits()->TotalSize;
+        while (true) {
+            size_t NewPoolSize = PoolSize + Slab.getSlabSize();
+
+            if (OwnAllocCtx.getLimits()->MaxSize < NewPoolSize) {
+                break;
+            }
+
+            if (OwnAllocCtx.getLimits()->TotalSize.compare_exchange_strong(
+                    PoolSize, NewPoolSize)) {
+                if (chunkedBucket) {
+                    ++chunkedSlabsInPool;
+                }
+
+                updateStats(-1, 1, Slab.getSlabSize());
+                ToPool = true;
+                return true;
+            }
+        }
+    }
+
+    updateStats(-1, 0, Slab.getSlabSize());
+    ToPool = false;
+    return false;
+}
+
+// Rounded up base-2 logarithm
+static size_t CeilLog2(size_t Val) {
+    return Val <= 1 ? 0 : getLeftmostSetBitPos(Val - 1) + 1;
+}
+
+void Bucket::initChunkIdxReciprocal() {
+    // For Offset < 2^L and Mul = ceil(2^Shift / Size), where
+    // 2^Shift >= 2^L * Size, the error of Offset * Mul / 2^Shift relative to
+    // Offset / Size is below 1 / Size, so the floor of both is the same.
+    size_t SlabSize = std::max(MaxSlabAllocSize(), size_t(1));
+    ChunkIdxShift = CeilLog2(SlabSize) + CeilLog2(Size);
+    ChunkIdxMul = 0;
+    if (ChunkIdxShift >= 64) {
+        return;
+    }
+
+    uint64_t Mul = ((uint64_t(1) << ChunkIdxShift) + Size - 1) / Size;
+    if (SlabSize - 1 > std::numeric_limits<uint64_t>::max() / Mul) {
+        return;
+    }
+    ChunkIdxMul = Mul;
+}
+
+umf_memory_provider_handle_t Bucket::getMemHandle() {
+    return OwnAllocCtx.getMemHandle();
+}
+
+size_t Bucket::SlabMinSize() { return OwnAllocCtx.getParams().SlabMinSize; }
+
+bool Bucket::isProviderMemoryZeroed() {
+    return OwnAllocCtx.getParams().ProviderMemoryZeroed != 0;
+}
+
+size_t Bucket::SlabAllocSize() { return CurSlabSize; }
+
+size_t Bucket::MaxSlabAllocSize() {
+    size_t MaxSize = std::max(getSize(), SlabMinSize());
+    if (!isChunked()) {
+        return MaxSize;
+    }
+
+    auto MaxSlabSize = OwnAllocCtx.getParams().MaxSlabSize;
+    while (MaxSize <= MaxSlabSize / 2) {
+        MaxSize *= 2;
+    }
+    return MaxSize;
+}
+
+size_t Bucket::Capacity() {
+    // For buckets used in chunked mode, just one slab in pool is sufficient.
+    // For larger buckets, the capacity could be more and is adjustable.
+    if (isChunked()) {
+        return 1;
+    } else {
+        return TunedCapacity.load(std::memory_order_relaxed);
+    }
+}
+
+size_t Bucket::MaxPoolableSize() { return OwnAllocCtx.getMaxPoolableSize(); }
+
+size_t Bucket::ChunkCutOff() { return SlabMinSize() / 2; }
+
+bool Bucket::isChunked() { return getSize() <= ChunkCutOff(); }
+
+void Bucket::countAlloc(bool FromPool) {
+    allocCount.fetch_add(1, std::memory_order_relaxed);
+    if (FromPool) {
+        allocPoolCount.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void Bucket::countFree() { freeCount.fetch_add(1, std::memory_order_relaxed); }
+
+void Bucket::updateStats(int InUse, int InPool, size_t SlabSize) {
+    // Only the thread holding BucketLock writes the slab counts.
+    auto InUseSlabs = currSlabsInUse.load(std::memory_order_relaxed) + InUse;
+    currSlabsInUse.store(InUseSlabs, std::memory_order_relaxed);
+    if (InUseSlabs > maxSlabsInUse.load(std::memory_order_relaxed)) {
+        maxSlabsInUse.store(InUseSlabs, std::memory_order_relaxed);
+    }
+    auto InPoolSlabs = currSlabsInPool.load(std::memory_order_relaxed) + InPool;
+    currSlabsInPool.store(InPoolSlabs, std::memory_order_relaxed);
+    if (InPoolSlabs > maxSlabsInPool.load(std::memory_order_relaxed)) {
+        maxSlabsInPool.store(InPoolSlabs, std::memory_order_relaxed);
+    }
+    TuneMaxSlabsInUse = std::max(TuneMaxSlabsInUse, InUseSlabs);
+    TuneMinSlabsInPool = std::min(TuneMinSlabsInPool, InPoolSlabs);
+
+    if (OwnAllocCtx.getParams().PoolTrace == 0) {
+        return;
+    }
+    // Increment or decrement current pool sizes based on whether
+    // slab was added to or removed from pool.
+    OwnAllocCtx.getParams().CurPoolSize += InPool * SlabSize;
+}
+
+void Bucket::getStats(umf_disjoint_pool_bucket_stats_t &Stats) {
+    Stats.BucketSize = getSize();
+    Stats.SlabSize = SlabAllocSize();
+    Stats.ProviderAllocatedSize = AllocatedSize.load(std::memory_order_relaxed);
+    Stats.AllocCount = allocCount.load(std::memory_order_relaxed);
+    Stats.FreeCount = freeCount.load(std::memory_order_relaxed);
+    Stats.AllocPoolCount = allocPoolCount.load(std::memory_order_relaxed);
+    Stats.SlabsInUse = currSlabsInUse.load(std::memory_order_relaxed);
+    Stats.SlabsInPool = currSlabsInPool.load(std::memory_order_relaxed);
+    Stats.MaxSlabsInUse = maxSlabsInUse.load(std::memory_order_relaxed);
+    Stats.MaxSlabsInPool = maxSlabsInPool.load(std::memory_order_relaxed);
+    Stats.Capacity = Capacity();
+}
+
+void Bucket::printStats(bool &TitlePrinted, const std::string &Label) {
+    if (allocCount) {
+        if (!TitlePrinted) {
+            std::cout << Label << " memory statistics\n";
+            std::cout << std::setw(14) << "Bucket Size" << std::setw(12)
+                      << "Allocs" << std::setw(12) << "Frees" << std::setw(18)
+                      << "Allocs from Pool" << std::setw(20)
+                      << "Peak Slabs in Use" << std::setw(21)
+                      << "Peak Slabs in Pool" << std::endl;
+            TitlePrinted = true;
+        }
+        std::cout << std::setw(14) << getSize() << std::setw(12) << allocCount
+                  << std::setw(12) << freeCount << std::setw(18)
+                  << allocPoolCount << std::setw(20) << maxSlabsInUse
+                  << std::setw(21) << maxSlabsInPool << std::endl;
+    }
+}
+
+umf_result_t ThreadCache::init(size_t NumBuckets) {
+    Caches.reset(new (std::nothrow) BucketCache[NumBuckets]);
+    if (!Caches) {
+        return UMF_RESULT_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    NumCaches = NumBuckets;
+    return UMF_RESULT_SUCCESS;
+}
+
+umf_result_t ThreadCache::initChunks(BucketCache &Cache) {
+    if (!Cache.Chunks) {
+        Cache.Chunks.reset(new (std::nothrow) CachedChunk[Capacity]);
+        if (!Cache.Chunks) {
+            return UMF_RESULT_ERROR_OUT_OF_HOST_MEMORY;
+        }
+    }
+    return UMF_RESULT_SUCCESS;
+}
+
+umf_result_t ThreadCache::getChunk(Bucket &Bucket, size_t BucketIdx,
+                                   void **Ptr, bool &FromPool, bool &Zeroed) {
+    assert(BucketIdx < NumCaches);
+    auto &Cache = Caches[BucketIdx];
+    if (Cache.Count == 0) {
+        auto Ret = initChunks(Cache);
+        if (Ret != UMF_RESULT_SUCCESS) {
+            return Ret;
+        }
+        Ret = Bucket.getChunks(Cache.Chunks.get(),
+                               std::max<size_t>(Capacity / 2, 1), Cache.Count,
+                               FromPool);
+        if (Ret != UMF_RESULT_SUCCESS) {
+            return Ret;
+        }
+    } else {
+        FromPool = true;
+    }
+
+    auto &Chunk = Cache.Chunks[--Cache.Count];
+    Zeroed = Chunk.Zeroed;
+    *Ptr = Chunk.Ptr;
+    return UMF_RESULT_SUCCESS;
+}
+
+void ThreadCache::freeChunk(size_t BucketIdx, void *Ptr, Slab &Slab,
+                            bool &ToPool) {
+    assert(BucketIdx < NumCaches);
+    auto &Cache = Caches[BucketIdx];
+    if (initChunks(Cache) != UMF_RESULT_SUCCESS) {
+        // Without a cache the chunk goes straight back to its bucket.
+        Slab.getBucket().freeChunk(Ptr, Slab, ToPool);
+        return;
+    }
+
+    ToPool = true;
+    if (Cache.Count == Capacity) {
+        // Return the least recently freed half of the cache to the bucket
+        size_t NumFlushed = std::max<size_t>(Capacity / 2, 1);
+        flush(Cache, NumFlushed, ToPool);
+    }
+
+    // The pointer might have been aligned within the chunk
+    Cache.Chunks[Cache.Count++] = {Slab.getChunkStart(Ptr), &Slab, false};
+}
+
+void ThreadCache::flush(BucketCache &Cache, size_t Count, bool &ToPool) {
+    // All the chunks of a bucket cache belong to the same bucket
+    if (Count) {
+        auto &Bucket = Cache.Chunks[0].OwnerSlab->getBucket();
+        Bucket.freeChunks(Cache.Chunks.get(), Count, ToPool);
+    }
+
+    std::move(Cache.Chunks.get() + Count,
+              Cache.Chunks.get() + Cache.Count, Cache.Chunks.get());
+    Cache.Count -= Count;
+}
+
+umf_result_t ThreadCache::getOwnedChunk(Bucket &Bucket, size_t BucketIdx,
+                                        void **Ptr, bool &FromPool,
+                                        bool &Zeroed) {
+    assert(BucketIdx < NumCaches);
+    return Bucket.getOwnedChunk(Caches[BucketIdx].OwnedSlab, Ptr, FromPool,
+                                Zeroed);
+}
+
+void ThreadCache::flush() {
+    bool ToPool;
+    for (size_t Idx = 0; Idx < NumCaches; Idx++) {
+        auto &Cache = Caches[Idx];
+        flush(Cache, Cache.Count, ToPool);
+        if (Cache.OwnedSlab) {
+            Cache.OwnedSlab->getBucket().releaseSlab(*Cache.OwnedSlab);
+            Cache.OwnedSlab = nullptr;
+        }
+    }
+}
+
+ThreadCache *ThreadCacheList::create(DisjointPool::AllocImpl &AllocCtx,
+                                     size_t Capacity) {
+    std::lock_guard<std::mutex> Lg(ThreadCachesLock);
+
+    // Drop caches of the pools which were destroyed in the meantime
+    for (auto **Link = &Head; *Link;) {
+        auto *Cache = *Link;
+        if (Cache->getAllocCtx()) {
+            Link = &Cache->ThreadNext;
+        } else {
+            *Link = Cache->ThreadNext;
+            delete Cache;
+        }
+    }
+
+    auto *Cache = new (std::nothrow) ThreadCache(AllocCtx, Capacity);
+    if (!Cache) {
+        return nullptr;
+    }
+    if (Cache->init(AllocCtx.getNumBuckets()) != UMF_RESULT_SUCCESS) {
+        delete Cache;
+        return nullptr;
+    }
+
+    Cache->ThreadNext = Head;
+    Head = Cache;
+    AllocCtx.addThreadCache(Cache);
+    return Cache;
+}
+
+ThreadCacheList::~ThreadCacheList() {
+    std::lock_guard<std::mutex> Lg(ThreadCachesLock);
+
+    while (auto *Cache = Head) {
+        Head = Cache->ThreadNext;
+        if (auto *AllocCtx = Cache->getAllocCtx()) {
+            Cache->flush();
+            AllocCtx->removeThreadCache(Cache);
+        }
+        delete Cache;
+    }
+}
+
+umf_result_t DisjointPool::AllocImpl::init() {
+    if (!KnownSlabs || !LargeAllocs) {
+        return UMF_RESULT_ERROR_OUT_OF_HOST_MEMORY;
+    }
+
+    auto Ret = initSizeClasses();
+    if (Ret != UMF_RESULT_SUCCESS) {
+        return Ret;
+    }
+
+    size_t NumSets = NumNodes * NumShards;
+    Buckets.reset(new (std::nothrow)
+                      std::unique_ptr<Bucket>[NumSets * NumBucketsPerSet]);
+    if (!Buckets) {
+        return UMF_RESULT_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    for (size_t Idx = 0; Idx < NumSets * NumBucketsPerSet; Idx++) {
+        Buckets[Idx].reset(new (std::nothrow) Bucket(
+            SizeClasses[Idx % NumBucketsPerSet], Idx, *this));
+        if (!Buckets[Idx]) {
+            return UMF_RESULT_ERROR_OUT_OF_HOST_MEMORY;
+        }
+    }
+    NumBuckets = NumSets * NumBucketsPerSet;
+
+    // Link the shards of each size class of a node in a ring, and the
+    // buckets of each set to the ones of the neighbouring sizes.
+    for (size_t Set = 0; Set < NumSets; Set++) {
+        size_t NextSet = Set + 1;
+        if (NextSet % NumShards == 0) {
+            NextSet -= NumShards;
+        }
+        for (size_t Idx = 0; Idx < NumBucketsPerSet; Idx++) {
+            auto &Bucket = *Buckets[Set * NumBucketsPerSet + Idx];
+            Bucket.setNextShard(*Buckets[NextSet * NumBucketsPerSet + Idx]);
+            if (Idx + 1 < NumBucketsPerSet) {
+                Bucket.setLarger(*Buckets[Set * NumBucketsPerSet + Idx + 1]);
+            }
+        }
+    }
+
+    Ret = umfMemoryProviderGetMinPageSize(MemHandle, nullptr,
+                                          &ProviderMinPageSize);
+    if (Ret != UMF_RESULT_SUCCESS) {
+        ProviderMinPageSize = 0;
+    }
+
+    initDecay();
+    initAutoTune();
+
+    if (params.SharedLimits) {
+        std::lock_guard<std::mutex> Lg(params.SharedLimits->Lock);
+        auto *&Pools = params.SharedLimits->Pools;
+        LimitsNext = Pools;
+        if (Pools) {
+            Pools->LimitsPrev = this;
+        }
+        Pools = this;
+        InLimits = true;
+    }
+
+    return UMF_RESULT_SUCCESS;
+}
+
+DisjointPool::AllocImpl::~AllocImpl() {
+    if (InLimits) {
+        std::lock_guard<std::mutex> Lg(params.SharedLimits->Lock);
+        if (LimitsPrev) {
+            LimitsPrev->LimitsNext = LimitsNext;
+        } else {
+            assert(params.SharedLimits->Pools == this);
+            params.SharedLimits->Pools = LimitsNext;
+        }
+        if (LimitsNext) {
+            LimitsNext->LimitsPrev = LimitsPrev;
+        }
+    }
+
+    if (DecayThread.joinable()) {
+        {
+            std::lock_guard<std::mutex> Lg(DecayLock);
+            StopDecay = true;
+        }
+        DecayCv.notify_one();
+        DecayThread.join();
+    }
+
+    {
+        std::lock_guard<std::mutex> Lg(ThreadCachesLock);
+
+        // Caches are freed by their threads, just return the chunks to
+        // buckets.
+        for (auto *Cache = ThreadCaches; Cache; Cache = Cache->PoolNext) {
+            Cache->flush();
+            Cache->detach();
+        }
+        ThreadCaches = nullptr;
+    }
+
+    flushLargeCache();
+}
+
+void DisjointPool::AllocImpl::addThreadCache(ThreadCache *Cache) {
+    assert(!Cache->PoolPrev && !Cache->PoolNext);
+    Cache->PoolNext = ThreadCaches;
+    if (ThreadCaches) {
+        ThreadCaches->PoolPrev = Cache;
+    }
+    ThreadCaches = Cache;
+}
+
+void DisjointPool::AllocImpl::removeThreadCache(ThreadCache *Cache) {
+    if (Cache->PoolPrev) {
+        Cache->PoolPrev->PoolNext = Cache->PoolNext;
+    } else {
+        assert(ThreadCaches == Cache);
+        ThreadCaches = Cache->PoolNext;
+    }
+    if (Cache->PoolNext) {
+        Cache->PoolNext->PoolPrev = Cache->PoolPrev;
+    }
+    Cache->PoolPrev = Cache->PoolNext = nullptr;
+}
+
+umf_result_t DisjointPool::AllocImpl::getChunk(Bucket &Bucket, void **Ptr,
+                                               bool &FromPool, bool &Zeroed) {
+    if (!getParams().ThreadCacheSize && !getParams().ThreadOwnedSlabs) {
+        return Bucket.getChunk(Ptr, FromPool, Zeroed);
+    }
+
+    auto *Cache = LocalThreadCaches.find(PoolId);
+    if (!Cache) {
+        Cache = LocalThreadCaches.create(*this, getParams().ThreadCacheSize);
+        if (!Cache) {
+            return UMF_RESULT_ERROR_OUT_OF_HOST_MEMORY;
+        }
+    }
+
+    if (getParams().ThreadOwnedSlabs) {
+        return Cache->getOwnedChunk(Bucket, Bucket.getIdx(), Ptr, FromPool,
+                                    Zeroed);
+    }
+    return Cache->getChunk(Bucket, Bucket.getIdx(), Ptr, FromPool, Zeroed);
+}
+
+void DisjointPool::AllocImpl::freeChunk(Bucket &Bucket, void *Ptr, Slab &Slab,
+                                        bool &ToPool) {
+    if (getParams().ThreadOwnedSlabs) {
+        Bucket.freeOwnedChunk(Ptr, Slab, ToPool);
+        return;
+    }
+
+    if (!getParams().ThreadCacheSize) {
+        Bucket.freeChunk(Ptr, Slab, ToPool);
+        return;
+    }
+
+    auto *Cache = LocalThreadCaches.find(PoolId);
+    if (!Cache) {
+        Cache = LocalThreadCaches.create(*this, getParams().ThreadCacheSize);
+        if (!Cache) {
+            Bucket.freeChunk(Ptr, Slab, ToPool);
+            return;
+        }
+    }
+
+    Cache->freeChunk(Bucket.getIdx(), Ptr, Slab, ToPool);
+}
+
+void *DisjointPool::AllocImpl::allocate(size_t Size, bool &FromPool) {
+    bool Zeroed;
+    return allocate(Size, FromPool, Zeroed);
+}
+
+void *DisjointPool::AllocImpl::allocateZeroed(size_t Size, bool &FromPool) {
+    bool Zeroed;
+    void *Ptr = allocate(Size, FromPool, Zeroed);
+    if (Ptr && !Zeroed) {
+        zeroMemory(Ptr, Size);
+    }
+    return Ptr;
+}
+
+void *DisjointPool::AllocImpl::allocate(size_t Size, bool &FromPool,
+                                        bool &Zeroed) {
+    void *Ptr = nullptr;
+    umf_result_t Ret;
+
+    if (Size == 0) {
+        return nullptr;
+    }
+
+    tickDecay();
+    tickAutoTune(Size);
+
+    FromPool = false;
+    if (Size > getMaxPoolableSize()) {
+        Ret = allocateLarge(&Ptr, Size, 0, FromPool);
+        Zeroed = !FromPool && getParams().ProviderMemoryZeroed != 0;
+    } else {
+        auto &Bucket = findBucket(Size);
+
+        if (!Bucket.isChunked()) {
+            Ret = Bucket.getSlab(&Ptr, FromPool, Zeroed);
+        } else {
+            Ret = getChunk(Bucket, &Ptr, FromPool, Zeroed);
+        }
+
+        if (Ret == UMF_RESULT_SUCCESS) {
+            Bucket.countAlloc(FromPool);
+        }
+    }
+
+    if (Ret != UMF_RESULT_SUCCESS) {
+        umf::getPoolLastStatusRef<DisjointPool>() = Ret;
+        return nullptr;
+    }
+
+    return Ptr;
+}
+
+void *DisjointPool::AllocImpl::allocate(size_t Size, size_t Alignment,
+                                        bool &FromPool) {
+    void *Ptr = nullptr;
+    umf_result_t Ret;
+
+    if (Size == 0) {
+        return nullptr;
+    }
+
+    if (Alignment <= 1) {
+        return allocate(Size, FromPool);
+    }
+
+    tickDecay();
+
+    size_t AlignedSize;
+    size_t SlabAlignment = 0;
+    if (Alignment <= ProviderMinPageSize) {
+        // This allocation will be served from a Bucket which size is multiple
+        // of Alignment and Slab address is aligned to ProviderMinPageSize
+        // so the address will be properly aligned.
+        AlignedSize = (Size > 1) ? AlignUp(Size, Alignment) : Alignment;
+
+        // Listed size classes may not be multiples of Alignment, the
+        // allocation then compensates for that within its chunk.
+        if (AlignedSize <= CutOff &&
+            SizeClasses[sizeToIdx(AlignedSize)] % Alignment) {
+            AlignedSize = Size + Alignment - 1;
+        }
+    } else if (Size + Alignment - 1 <= SlabMinSize() / 2) {
+        // Slabs are only aligned to ProviderMinPageSize, small allocations
+        // compensate for that within their chunks.
+        AlignedSize = Size + Alignment - 1;
+    } else {
+        // Larger allocations take an entire slab, which is created with the
+        // requested alignment if no pooled slab is aligned.
+        AlignedSize = std::max(Size, SlabMinSize() / 2 + 1);
+        SlabAlignment = Alignment;
+    }
+
+    tickAutoTune(AlignedSize);
+
+    // Check if requested allocation size is within pooling limit.
+    // If not, just request aligned pointer from the system.
+    FromPool = false;
+    if (AlignedSize > getMaxPoolableSize()) {
+        Ret = allocateLarge(&Ptr, Size, Alignment, FromPool);
+        if (Ret != UMF_RESULT_SUCCESS) {
+            umf::getPoolLastStatusRef<DisjointPool>() = Ret;
+            return nullptr;
+        }
+        return Ptr;
+    }
+
+    auto &Bucket = findBucket(AlignedSize);
+
+    bool Zeroed;
+    if (!Bucket.isChunked()) {
+        Ret = Bucket.getSlab(&Ptr, FromPool, Zeroed, SlabAlignment);
+    } else {
+        Ret = getChunk(Bucket, &Ptr, FromPool, Zeroed);
+    }
+
+    if (Ret != UMF_RESULT_SUCCESS) {
+        umf::getPoolLastStatusRef<DisjointPool>() = Ret;
+        return nullptr;
+    }
+
+    Bucket.countAlloc(FromPool);
+
+    return AlignPtrUp(Ptr, Alignment);
+}
+
+// Number of allocations of a thread between checks whether the decay is due
+static constexpr unsigned DecayTickInterval = 256;
+
+void DisjointPool::AllocImpl::initDecay() {
+    auto PurgeMs = getParams().PurgeDecayMs;
+    auto FreeMs = getParams().FreeDecayMs;
+    if (!PurgeMs && !FreeMs) {
+        return;
+    }
+
+    // Slabs are purged or freed at most a quarter of the decay time late.
+    uint64_t MinDecayMs = (PurgeMs && FreeMs) ? std::min(PurgeMs, FreeMs)
+                                              : std::max(PurgeMs, FreeMs);
+    DecayPeriodMs = std::max<uint64_t>(MinDecayMs / 4, 1);
+    NextDecayMs = getTimeMs() + DecayPeriodMs;
+
+    if (getParams().DecayBackgroundThread) {
+        DecayThread = std::thread([this] {
+            std::unique_lock<std::mutex> Lk(DecayLock);
+            auto Period = std::chrono::milliseconds(DecayPeriodMs);
+            while (!DecayCv.wait_for(Lk, Period, [this] { return StopDecay; })) {
+                decay(getTimeMs());
+            }
+        });
+    }
+}
+
+void DisjointPool::AllocImpl::tickDecay() {
+    static thread_local unsigned Ticks = 0;
+    if (!DecayPeriodMs || DecayThread.joinable() ||
+        ++Ticks % DecayTickInterval) {
+        return;
+    }
+
+    // Only one of the threads which find the decay due applies it.
+    auto Now = getTimeMs();
+    auto Next = NextDecayMs.load(std::memory_order_relaxed);
+    if (Now < Next ||
+        !NextDecayMs.compare_exchange_strong(Next, Now + DecayPeriodMs)) {
+        return;
+    }
+
+    decay(Now);
+}
+
+void DisjointPool::AllocImpl::decay(uint64_t Now) {
+    for (size_t Idx = 0; Idx < NumBuckets; Idx++) {
+        Buckets[Idx]->decay(Now);
+    }
+    decayLargeCache(Now);
+}
+
+void DisjointPool::AllocImpl::initAutoTune() {
+    PoolableSize = params.MaxPoolableSize;
+    MaxTunedPoolableSize = params.MaxPoolableSize;
+    if (!params.AutoTuneIntervalMs) {
+        return;
+    }
+
+    // Only the generated size classes have buckets above MaxPoolableSize.
+    // Allocations larger than the whole pool could never be pooled.
+    if (!params.SizeClasses) {
+        MaxTunedPoolableSize =
+            std::max(params.MaxPoolableSize,
+                     std::min(CutOff, getLimits()->MaxSize));
+    }
+    NextTuneMs = getTimeMs() + params.AutoTuneIntervalMs;
+}
+
+void DisjointPool::AllocImpl::tickAutoTune(size_t Size) {
+    if (!params.AutoTuneIntervalMs) {
+        return;
+    }
+
+    auto Poolable = getMaxPoolableSize();
+    if (Size > Poolable && Size / 2 <= Poolable) {
+        NearPoolableAllocs.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    static thread_local unsigned Ticks = 0;
+    if (++Ticks % DecayTickInterval) {
+        return;
+    }
+
+    auto Now = getTimeMs();
+    auto Next = NextTuneMs.load(std::memory_order_relaxed);
+    if (Now < Next || !NextTuneMs.compare_exchange_strong(
+                          Next, Now + params.AutoTuneIntervalMs)) {
+        return;
+    }
+
+    tune();
+}
+
+void DisjointPool::AllocImpl::tune() {
+    std::unique_lock<std::mutex> Lk(TuneLock, std::try_to_lock);
+    if (!Lk) {
+        return;
+    }
+
+    auto Poolable = getMaxPoolableSize();
+    size_t TopAllocs = 0;
+    for (size_t Idx = 0; Idx < NumBuckets; Idx++) {
+        auto &B = Buckets[Idx];
+        auto Allocs = B->tune();
+        if (B->getSize() > Poolable / 2 && B->getSize() <= Poolable) {
+            TopAllocs += Allocs;
+        }
+    }
+
+    // Pool the allocations just above the limit while they are frequent,
+    // and return to the configured limit once the largest pooled sizes are
+    // not used anymore.
+    auto NearAllocs = NearPoolableAllocs.exchange(0, std::memory_order_relaxed);
+    if (NearAllocs >= AutoTuneMinAllocs) {
+        Poolable = std::min(std::max(Poolable * 2, SlabMinSize()),
+                            MaxTunedPoolableSize);
+    } else if (!NearAllocs && !TopAllocs) {
+        Poolable = std::max(Poolable / 2, params.MaxPoolableSize);
+    }
+    PoolableSize.store(Poolable, std::memory_order_relaxed);
+}
+
+umf_result_t DisjointPool::AllocImpl::initSizeClasses() {
+    // Generate buckets sized such as: 64, 80, 96, 112, 128, 160, ... for
+    // 4 classes per doubling, each doubling split into equal steps. With an
+    // explicit list they only cover the sizes above the largest listed one.
+    auto PerDoubling =
+        params.SizeClassesPerDoubling ? params.SizeClassesPerDoubling : 2;
+    auto First = params.MinBucketSize;
+    // MinBucketSize cannot be larger than CutOff.
+    First = std::min(First, CutOff);
+    // Buckets sized smaller than the bucket default size- 8 aren't
+    // needed.
+    First = std::max(First, UMF_DISJOINT_POOL_MIN_BUCKET_DEFAULT_SIZE);
+    // Steps keep the chunks of all buckets aligned to the minimum size.
+    auto getStep = [&](size_t Size1) {
+        return std::max(Size1 / PerDoubling,
+                        UMF_DISJOINT_POOL_MIN_BUCKET_DEFAULT_SIZE);
+    };
+
+    // Room for the listed sizes, the generated ones and CutOff
+    size_t MaxClasses = params.NumSizeClasses + 1;
+    for (auto Size1 = First; Size1 < CutOff; Size1 *= 2) {
+        MaxClasses += Size1 / getStep(Size1);
+    }
+    SizeClasses.reset(new (std::nothrow) size_t[MaxClasses]);
+    if (!SizeClasses) {
+        return UMF_RESULT_ERROR_OUT_OF_HOST_MEMORY;
+    }
+
+    size_t NumClasses = 0;
+    if (params.SizeClasses) {
+        auto *Begin = SizeClasses.get();
+        std::copy(params.SizeClasses,
+                  params.SizeClasses + params.NumSizeClasses, Begin);
+        std::sort(Begin, Begin + params.NumSizeClasses);
+        NumClasses = std::unique(Begin, Begin + params.NumSizeClasses) - Begin;
+        if (SizeClasses[NumClasses - 1] == CutOff) {
+            NumClasses--;
+        }
+    }
+
+    auto Listed = NumClasses ? SizeClasses[NumClasses - 1] : 0;
+    for (auto Size1 = First; Size1 < CutOff; Size1 *= 2) {
+        auto Step = getStep(Size1);
+        for (auto Size = Size1; Size < Size1 * 2; Size += Step) {
+            if (Size > Listed) {
+                SizeClasses[NumClasses++] = Size;
+            }
+        }
+    }
+    SizeClasses[NumClasses++] = CutOff;
+    NumBucketsPerSet = NumClasses;
+
+    size_t Idx = 0;
+    for (size_t Size = 0; Size <= SmallSizeMax; Size++) {
+        while (SizeClasses[Idx] < Size) {
+            Idx++;
+        }
+        SmallSizeIdx[Size] = static_cast<uint16_t>(Idx);
+    }
+
+    Idx = 0;
+    for (size_t Exp = 0; Exp < sizeof(size_t) * 8; Exp++) {
+        size_t Pow2 = size_t(1) << Exp;
+        while (Idx < NumBucketsPerSet - 1 && SizeClasses[Idx] <= Pow2) {
+            Idx++;
+        }
+        FirstIdxAbovePow2[Exp] = Idx;
+    }
+
+    return UMF_RESULT_SUCCESS;
+}
+
+std::size_t DisjointPool::AllocImpl::sizeToIdx(size_t Size) {
+    assert(Size <= CutOff && "Unexpected size");
+    assert(Size > 0 && "Unexpected size");
+
+    if (Size <= SmallSizeMax) {
+        return SmallSizeIdx[Size];
+    }
+
+    // 2^Exp < Size <= 2^(Exp+1), the bucket is within the classes of this
+    // doubling, which is at most a few steps from the first one.
+    auto Idx = FirstIdxAbovePow2[getLeftmostSetBitPos(Size - 1)];
+    while (SizeClasses[Idx] < Size) {
+        Idx++;
+    }
+
+    return Idx;
+}
+
+Bucket &DisjointPool::AllocImpl::findBucket(size_t Size) {
+    auto calculatedIdx = sizeToIdx(Size);
+    assert(calculatedIdx >= 0);
+    assert((*(Buckets[calculatedIdx])).getSize() >= Size);
+    if (calculatedIdx > 0) {
+        assert((*(Buckets[calculatedIdx - 1])).getSize() < Size);
+    }
+
+    // Frees don't need the node and shard, slabs know the bucket they
+    // belong to.
+    if (NumNodes > 1 || NumShards > 1) {
+        size_t Cpu, Node;
+        util_get_current_cpu_and_node(&Cpu, &Node);
+        size_t Set = (Node % NumNodes) * NumShards + Cpu % NumShards;
+        calculatedIdx += Set * NumBucketsPerSet;
+    }
+
+    return *(Buckets[calculatedIdx]);
+}
+
+Slab *DisjointPool::AllocImpl::findSlab(void *Ptr) {
+    // The slab with the highest start address not greater than Ptr is the
+    // only one that may contain Ptr. The slab object can't be destroyed
+    // concurrently if Ptr belongs to it, as it has at least one allocated
+    // chunk.
+    auto *Slab = static_cast<class Slab *>(
+        critnib_find_le(getKnownSlabs(), reinterpret_cast<uintptr_t>(Ptr)));
+    if (Slab && Ptr < Slab->getEnd()) {
+        return Slab;
+    }
+
+    // A pointer from a system allocation which is placed after some slab.
+    return nullptr;
+}
+
+umf_result_t DisjointPool::AllocImpl::deallocate(void *Ptr, bool &ToPool,
+                                                 size_t Size) {
+    ToPool = false;
+
+    // Even aligned allocations above the largest MaxPoolableSize never come
+    // from slabs, so they are freed without looking up the slab.
+    if (Size > MaxTunedPoolableSize) {
+        return deallocateLarge(Ptr);
+    }
+
+    auto *Slab = findSlab(Ptr);
+    if (!Slab) {
+        return deallocateLarge(Ptr);
+    }
+
+    auto &Bucket = Slab->getBucket();
 
-    if (AvailableSlabs.size() == 0) {
-        auto It = AvailableSlabs.insert(AvailableSlabs.begin(),
-                                        std::make_unique<Slab>(*this));
-        (*It)->setIterator(It);
+    Bucket.countFree();
 
-        updateStats(1, 0);
-        FromPool = false;
+    if (Bucket.isChunked()) {
+        freeChunk(Bucket, Ptr, *Slab, ToPool);
     } else {
-        if ((*(AvailableSlabs.begin()))->getNumAllocated() == 0) {
-            // If this was an empty slab, it was in the pool.
-            // Now it is no longer in the pool, so update count.
-            --chunkedSlabsInPool;
-            decrementPool(FromPool);
-        } else {
-            // Allocation from existing slab is treated as from pool for statistics.
-            FromPool = true;
-        }
+        Bucket.freeSlab(*Slab, ToPool);
     }
-
-    return AvailableSlabs.begin();
+    return UMF_RESULT_SUCCESS;
 }
 
-void *Bucket::getChunk(bool &FromPool) {
-    std::lock_guard<std::mutex> Lg(BucketLock);
+umf_result_t DisjointPool::AllocImpl::allocateLarge(void **Ptr, size_t Size,
+                                                    size_t Alignment,
+                                                    bool &FromPool) {
+    // Keep provider allocations page-granular, so that their tails can be
+    // split off when they are reallocated.
+    if (ProviderMinPageSize) {
+        Size = AlignUp(Size, ProviderMinPageSize);
+    }
 
-    auto SlabIt = getAvailSlab(FromPool);
-    auto *FreeChunk = (*SlabIt)->getChunk();
+    FromPool = takeCachedLarge(Ptr, Size, Alignment);
+    if (!FromPool) {
+        auto Ret =
+            umfMemoryProviderAlloc(getMemHandle(), Size, Alignment, Ptr);
+        if (Ret != UMF_RESULT_SUCCESS) {
+            return Ret;
+        }
+        LargeAllocatedSize.fetch_add(Size, std::memory_order_relaxed);
+    }
 
-    // If the slab is full, move it to unavailable slabs and update its iterator
-    if (!((*SlabIt)->hasAvail())) {
-        auto It = UnavailableSlabs.insert(UnavailableSlabs.begin(),
-                                          std::move(*SlabIt));
-        AvailableSlabs.erase(SlabIt);
-        (*It)->setIterator(It);
+    if (critnib_insert(getLargeAllocs(), reinterpret_cast<uintptr_t>(*Ptr),
+                       reinterpret_cast<void *>(Size), 0 /* update */)) {
+        LargeAllocatedSize.fetch_sub(Size, std::memory_order_relaxed);
+        umfMemoryProviderFree(getMemHandle(), *Ptr, Size);
+        return UMF_RESULT_ERROR_OUT_OF_HOST_MEMORY;
     }
 
-    return FreeChunk;
+    LargeAllocCount.fetch_add(1, std::memory_order_relaxed);
+    return UMF_RESULT_SUCCESS;
 }
 
-void Bucket::freeChunk(void *Ptr, Slab &Slab, bool &ToPool) {
-    std::lock_guard<std::mutex> Lg(BucketLock);
+umf_result_t DisjointPool::AllocImpl::deallocateLarge(void *Ptr) {
+    auto Size = reinterpret_cast<size_t>(
+        critnib_remove(getLargeAllocs(), reinterpret_cast<uintptr_t>(Ptr)));
+    LargeFreeCount.fetch_add(1, std::memory_order_relaxed);
 
-    Slab.freeChunk(Ptr);
+    if (Size && Size <= getParams().LargeCacheSize) {
+        cacheLarge(Ptr, Size);
+        return UMF_RESULT_SUCCESS;
+    }
 
-    onFreeChunk(Slab, ToPool);
+    LargeAllocatedSize.fetch_sub(Size, std::memory_order_relaxed);
+    return umfMemoryProviderFree(getMemHandle(), Ptr, Size);
 }
 
-// The lock must be acquired before calling this method
-void Bucket::onFreeChunk(Slab &Slab, bool &ToPool) {
-    ToPool = true;
+bool DisjointPool::AllocImpl::takeCachedLarge(void **Ptr, size_t &Size,
+                                              size_t Alignment) {
+    if (!getParams().LargeCacheSize ||
+        !LargeCachedSize.load(std::memory_order_relaxed)) {
+        return false;
+    }
 
-    // In case if the slab was previously full and now has 1 available
-    // chunk, it should be moved to the list of available slabs
-    if (Slab.getNumAllocated() == (Slab.getNumChunks() - 1)) {
-        auto SlabIter = Slab.getIterator();
-        assert(SlabIter != UnavailableSlabs.end());
+    // Without splitting, an allocation is reused only if at most half of it
+    // is wasted.
+    bool CanSplit = ProviderMinPageSize && this->CanSplit;
+    size_t MaxSize = CanSplit ? std::numeric_limits<size_t>::max()
+                              : std::min(Size, SIZE_MAX / 2) * 2;
+
+    LargeExtent Extent;
+    {
+        std::lock_guard<std::mutex> Lg(LargeCacheLock);
+
+        // All extents of a bin are larger than the ones of lower bins, so
+        // the first bin with a fitting extent has the best fit.
+        LargeExtent **BestLink = nullptr;
+        for (size_t Bin = getLeftmostSetBitPos(Size);
+             Bin < LargeCacheBins.size() && !BestLink; Bin++) {
+            for (auto **Link = &LargeCacheBins[Bin]; *Link;
+                 Link = &(*Link)->Next) {
+                auto &E = **Link;
+                if (E.Size < Size || E.Size > MaxSize ||
+                    (Alignment &&
+                     (reinterpret_cast<uintptr_t>(E.Ptr) & (Alignment - 1)))) {
+                    continue;
+                }
+                if (!BestLink || E.Size < (*BestLink)->Size) {
+                    BestLink = Link;
+                }
+            }
+        }
 
-        auto It =
-            AvailableSlabs.insert(AvailableSlabs.begin(), std::move(*SlabIter));
-        UnavailableSlabs.erase(SlabIter);
+        if (!BestLink) {
+            return false;
+        }
 
-        (*It)->setIterator(It);
+        auto *Best = *BestLink;
+        *BestLink = Best->Next;
+        Extent = *Best;
+        Best->Next = nullptr;
+        releaseLargeExtents(Best);
+        LargeCachedSize.fetch_sub(Extent.Size, std::memory_order_relaxed);
     }
 
-    // Check if slab is empty, and pool it if we can.
-    if (Slab.getNumAllocated() == 0) {
-        // The slab is now empty.
-        // If pool has capacity then put the slab in the pool.
-        // The ToPool parameter indicates whether the Slab will be put in the
-        // pool or freed.
-        if (!CanPool(ToPool)) {
-            // Note: since the slab is stored as unique_ptr, just remove it from
-            // the list to destroy the object.
-            auto It = Slab.getIterator();
-            assert(It != AvailableSlabs.end());
-            AvailableSlabs.erase(It);
+    LargeCacheHitCount.fetch_add(1, std::memory_order_relaxed);
+    *Ptr = Extent.Ptr;
+    if (Extent.Size == Size) {
+        return true;
+    }
+
+    // The provider is called without the lock, the tail goes back to the
+    // cache.
+    if (CanSplit) {
+        auto Ret = umfMemoryProviderAllocationSplit(getMemHandle(), Extent.Ptr,
+                                                    Extent.Size, Size);
+        if (Ret == UMF_RESULT_SUCCESS) {
+            cacheLarge(static_cast<char *>(Extent.Ptr) + Size,
+                       Extent.Size - Size);
+            return true;
+        }
+        if (Ret == UMF_RESULT_ERROR_NOT_SUPPORTED) {
+            onSplitNotSupported();
         }
     }
+
+    Size = Extent.Size;
+    return true;
 }
 
-bool Bucket::CanPool(bool &ToPool) {
-    size_t NewFreeSlabsInBucket;
-    // Check if this bucket is used in chunked form or as full slabs.
-    bool chunkedBucket = getSize() <= ChunkCutOff();
-    if (chunkedBucket) {
-        NewFreeSlabsInBucket = chunkedSlabsInPool + 1;
-    } else {
-        NewFreeSlabsInBucket = AvailableSlabs.size() + 1;
-    }
-    if (Capacity() >= NewFreeSlabsInBucket) {
-        size_t PoolSize = OwnAllocCtx.getLimits()->TotalSize;
-        while (true) {
-            size_t NewPoolSize = PoolSize + SlabAllocSize();
+void DisjointPool::AllocImpl::cacheLarge(void *Ptr, size_t Size) {
+    LargeExtent *ToFree = nullptr;
+    {
+        std::unique_lock<std::mutex> Lk(LargeCacheLock);
+        auto *Extent = FreeLargeExtents;
+        if (!Extent) {
+            // All the slots are taken, the allocation is not cached.
+            Lk.unlock();
+            freeLarge(Ptr, Size);
+            return;
+        }
 
-            if (OwnAllocCtx.getLimits()->MaxSize < NewPoolSize) {
+        FreeLargeExtents = Extent->Next;
+        auto &Bin = LargeCacheBins[getLeftmostSetBitPos(Size)];
+        *Extent = {Ptr, Size, getTimeMs(), false, Bin};
+        Bin = Extent;
+        size_t CachedSize =
+            LargeCachedSize.fetch_add(Size, std::memory_order_relaxed) + Size;
+
+        // Evict the least recently freed extents over the budget.
+        while (CachedSize > getParams().LargeCacheSize) {
+            LargeExtent **OldestLink = nullptr;
+            for (auto &Bin : LargeCacheBins) {
+                for (auto **Link = &Bin; *Link; Link = &(*Link)->Next) {
+                    if (!OldestLink ||
+                        (*Link)->FreedAt < (*OldestLink)->FreedAt) {
+                        OldestLink = Link;
+                    }
+                }
+            }
+            if (!OldestLink) {
+                // The rest is being purged.
                 break;
             }
 
-            if (OwnAllocCtx.getLimits()->TotalSize.compare_exchange_strong(
-                    PoolSize, NewPoolSize)) {
-                if (chunkedBucket) {
-                    ++chunkedSlabsInPool;
-                }
-
-                updateStats(-1, 1);
-                ToPool = true;
-                return true;
-            }
+            auto *Oldest = *OldestLink;
+            *OldestLink = Oldest->Next;
+            Oldest->Next = ToFree;
+            ToFree = Oldest;
+            CachedSize -= Oldest->Size;
+            LargeCachedSize.fetch_sub(Oldest->Size, std::memory_order_relaxed);
         }
     }
 
-    updateStats(-1, 0);
-    ToPool = false;
-    return false;
-}
+    if (!ToFree) {
+        return;
+    }
 
-umf_memory_provider_handle_t Bucket::getMemHandle() {
-    return OwnAllocCtx.getMemHandle();
+    for (auto *Extent = ToFree; Extent; Extent = Extent->Next) {
+        freeLarge(Extent->Ptr, Extent->Size);
+    }
+    std::lock_guard<std::mutex> Lg(LargeCacheLock);
+    releaseLargeExtents(ToFree);
 }
 
-size_t Bucket::SlabMinSize() { return OwnAllocCtx.getParams().SlabMinSize; }
-
-size_t Bucket::SlabAllocSize() { return std::max(getSize(), SlabMinSize()); }
-
-size_t Bucket::Capacity() {
-    // For buckets used in chunked mode, just one slab in pool is sufficient.
-    // For larger buckets, the capacity could be more and is adjustable.
-    if (getSize() <= ChunkCutOff()) {
-        return 1;
-    } else {
-        return OwnAllocCtx.getParams().Capacity;
+void DisjointPool::AllocImpl::flushLargeCache() {
+    for (auto &Bin : LargeCacheBins) {
+        for (auto *Extent = Bin; Extent; Extent = Extent->Next) {
+            freeLarge(Extent->Ptr, Extent->Size);
+        }
+        releaseLargeExtents(Bin);
+        Bin = nullptr;
     }
+    LargeCachedSize = 0;
 }
 
-size_t Bucket::MaxPoolableSize() {
-    return OwnAllocCtx.getParams().MaxPoolableSize;
+void DisjointPool::AllocImpl::freeLarge(void *Ptr, size_t Size) {
+    LargeAllocatedSize.fetch_sub(Size, std::memory_order_relaxed);
+    auto Ret = umfMemoryProviderFree(getMemHandle(), Ptr, Size);
+    if (Ret != UMF_RESULT_SUCCESS) {
+        printProviderError(Ret);
+    }
 }
 
-size_t Bucket::ChunkCutOff() { return SlabMinSize() / 2; }
-
-void Bucket::countAlloc(bool FromPool) {
-    ++allocCount;
-    if (FromPool) {
-        ++allocPoolCount;
+void DisjointPool::AllocImpl::releaseLargeExtents(LargeExtent *Extents) {
+    while (auto *Extent = Extents) {
+        Extents = Extent->Next;
+        Extent->Next = FreeLargeExtents;
+        FreeLargeExtents = Extent;
     }
 }
 
-void Bucket::countFree() { ++freeCount; }
-
-void Bucket::updateStats(int InUse, int InPool) {
-    if (OwnAllocCtx.getParams().PoolTrace == 0) {
+void DisjointPool::AllocImpl::decayLargeCache(uint64_t Now) {
+    auto &Params = getParams();
+    if (!Params.LargeCacheSize ||
+        !LargeCachedSize.load(std::memory_order_relaxed)) {
         return;
     }
-    currSlabsInUse += InUse;
-    maxSlabsInUse = std::max(currSlabsInUse, maxSlabsInUse);
-    currSlabsInPool += InPool;
-    maxSlabsInPool = std::max(currSlabsInPool, maxSlabsInPool);
-    // Increment or decrement current pool sizes based on whether
-    // slab was added to or removed from pool.
-    OwnAllocCtx.getParams().CurPoolSize += InPool * SlabAllocSize();
-}
 
-void Bucket::printStats(bool &TitlePrinted, const std::string &Label) {
-    if (allocCount) {
-        if (!TitlePrinted) {
-            std::cout << Label << " memory statistics\n";
-            std::cout << std::setw(14) << "Bucket Size" << std::setw(12)
-                      << "Allocs" << std::setw(12) << "Frees" << std::setw(18)
-                      << "Allocs from Pool" << std::setw(20)
-                      << "Peak Slabs in Use" << std::setw(21)
-                      << "Peak Slabs in Pool" << std::endl;
-            TitlePrinted = true;
+    // Like for slabs, the provider is called without the lock. Extents being
+    // purged are out of the bins meanwhile, so that they are not reused.
+    LargeExtent *ToFree = nullptr;
+    LargeExtent *ToPurge = nullptr;
+    {
+        std::lock_guard<std::mutex> Lg(LargeCacheLock);
+        for (auto &Bin : LargeCacheBins) {
+            for (auto **Link = &Bin; *Link;) {
+                auto *E = *Link;
+                auto IdleTime = Now > E->FreedAt ? Now - E->FreedAt : 0;
+                LargeExtent **To;
+                if (Params.FreeDecayMs && IdleTime >= Params.FreeDecayMs) {
+                    To = &ToFree;
+                    LargeCachedSize.fetch_sub(E->Size,
+                                              std::memory_order_relaxed);
+                } else if (Params.PurgeDecayMs &&
+                           IdleTime >= Params.PurgeDecayMs && !E->Purged) {
+                    To = &ToPurge;
+                } else {
+                    Link = &E->Next;
+                    continue;
+                }
+                *Link = E->Next;
+                E->Next = *To;
+                *To = E;
+            }
         }
-        std::cout << std::setw(14) << getSize() << std::setw(12) << allocCount
-                  << std::setw(12) << freeCount << std::setw(18)
-                  << allocPoolCount << std::setw(20) << maxSlabsInUse
-                  << std::setw(21) << maxSlabsInPool << std::endl;
     }
-}
-
-void *DisjointPool::AllocImpl::allocate(size_t Size, bool &FromPool) try {
-    void *Ptr;
 
-    if (Size == 0) {
-        return nullptr;
+    for (auto *Extent = ToFree; Extent; Extent = Extent->Next) {
+        freeLarge(Extent->Ptr, Extent->Size);
     }
 
-    FromPool = false;
-    if (Size > getParams().MaxPoolableSize) {
-        return memoryProviderAlloc(getMemHandle(), Size);
+    // Errors are ignored, the memory just stays populated.
+    for (auto *Extent = ToPurge; Extent; Extent = Extent->Next) {
+        umfMemoryProviderPurgeLazy(getMemHandle(), Extent->Ptr, Extent->Size);
+        Extent->Purged = true;
     }
 
-    auto &Bucket = findBucket(Size);
-
-    if (Size > Bucket.ChunkCutOff()) {
-        Ptr = Bucket.getSlab(FromPool);
-    } else {
-        Ptr = Bucket.getChunk(FromPool);
+    if (!ToFree && !ToPurge) {
+        return;
     }
 
-    if (getParams().PoolTrace > 1) {
-        Bucket.countAlloc(FromPool);
+    std::lock_guard<std::mutex> Lg(LargeCacheLock);
+    releaseLargeExtents(ToFree);
+    while (auto *Extent = ToPurge) {
+        ToPurge = Extent->Next;
+        auto &Bin = LargeCacheBins[getLeftmostSetBitPos(Extent->Size)];
+        Extent->Next = Bin;
+        Bin = Extent;
     }
-
-    return Ptr;
-} catch (MemoryProviderError &e) {
-    umf::getPoolLastStatusRef<DisjointPool>() = e.code;
-    return nullptr;
 }
 
-void *DisjointPool::AllocImpl::allocate(size_t Size, size_t Alignment,
-                                        bool &FromPool) try {
-    void *Ptr;
+size_t DisjointPool::AllocImpl::getLargeAllocSize(void *Ptr) {
+    return reinterpret_cast<size_t>(
+        critnib_get(getLargeAllocs(), reinterpret_cast<uintptr_t>(Ptr)));
+}
 
-    if (Size == 0) {
-        return nullptr;
+void DisjointPool::AllocImpl::shrinkLarge(void *Ptr, size_t OldSize,
+                                          size_t Size) {
+    // Without the page size the tail can't be returned to the provider, the
+    // allocation just stays as large as it is.
+    if (!ProviderMinPageSize) {
+        return;
     }
 
-    if (Alignment <= 1) {
-        return allocate(Size, FromPool);
+    size_t NewSize = AlignUp(Size, ProviderMinPageSize);
+    if (NewSize >= OldSize) {
+        return;
     }
 
-    size_t AlignedSize;
-    if (Alignment <= ProviderMinPageSize) {
-        // This allocation will be served from a Bucket which size is multiple
-        // of Alignment and Slab address is aligned to ProviderMinPageSize
-        // so the address will be properly aligned.
-        AlignedSize = (Size > 1) ? AlignUp(Size, Alignment) : Alignment;
-    } else {
-        // Slabs are only aligned to ProviderMinPageSize, we need to compensate
-        // for that in case the allocation is within pooling limit.
-        // TODO: consider creating properly-aligned Slabs on demand
-        AlignedSize = Size + Alignment - 1;
+    auto Ret = umfMemoryProviderAllocationSplit(getMemHandle(), Ptr, OldSize,
+                                                NewSize);
+    if (Ret != UMF_RESULT_SUCCESS) {
+        return;
     }
 
-    // Check if requested allocation size is within pooling limit.
-    // If not, just request aligned pointer from the system.
-    FromPool = false;
-    if (AlignedSize > getParams().MaxPoolableSize) {
-        return memoryProviderAlloc(getMemHandle(), Size, Alignment);
-    }
+    critnib_insert(getLargeAllocs(), reinterpret_cast<uintptr_t>(Ptr),
+                   reinterpret_cast<void *>(NewSize), 1 /* update */);
+    LargeAllocatedSize.fetch_sub(OldSize - NewSize, std::memory_order_relaxed);
 
-    auto &Bucket = findBucket(AlignedSize);
+    // If this fails, the tail is leaked, but the allocation itself is still
+    // valid.
+    umfMemoryProviderFree(getMemHandle(), static_cast<char *>(Ptr) + NewSize,
+                          OldSize - NewSize);
+}
 
-    if (AlignedSize > Bucket.ChunkCutOff()) {
-        Ptr = Bucket.getSlab(FromPool);
-    } else {
-        Ptr = Bucket.getChunk(FromPool);
+void *DisjointPool::AllocImpl::reallocate(void *Ptr, size_t Size) {
+    bool FromPool;
+    bool ToPool;
+
+    if (!Ptr) {
+        return allocate(Size, FromPool);
     }
 
-    if (getParams().PoolTrace > 1) {
-        Bucket.countAlloc(FromPool);
+    if (Size == 0) {
+        auto Ret = deallocate(Ptr, ToPool);
+        if (Ret != UMF_RESULT_SUCCESS) {
+            umf::getPoolLastStatusRef<DisjointPool>() = Ret;
+        }
+        return nullptr;
     }
 
-    return AlignPtrUp(Ptr, Alignment);
-} catch (MemoryProviderError &e) {
-    umf::getPoolLastStatusRef<DisjointPool>() = e.code;
-    return nullptr;
-}
+    size_t OldSize;
+    if (auto *Slab = findSlab(Ptr)) {
+        // Stay in the current chunk or slab as long as the new size fits.
+        OldSize = Slab->getUsableSize(Ptr);
+        if (Size <= OldSize) {
+            return Ptr;
+        }
+    } else {
+        OldSize = getLargeAllocSize(Ptr);
+        if (!OldSize) {
+            umf::getPoolLastStatusRef<DisjointPool>() =
+                UMF_RESULT_ERROR_INVALID_ARGUMENT;
+            return nullptr;
+        }
 
-std::size_t DisjointPool::AllocImpl::sizeToIdx(size_t Size) {
-    assert(Size <= CutOff && "Unexpected size");
-    assert(Size > 0 && "Unexpected size");
+        // Allocations which stay above the pooling limit shrink in place.
+        // Providers can't reserve the memory right after an allocation, so
+        // growing ones are moved, as are the ones small enough for the pool.
+        if (Size > getMaxPoolableSize() && Size <= OldSize) {
+            shrinkLarge(Ptr, OldSize, Size);
+            return Ptr;
+        }
+    }
 
-    size_t MinBucketSize = (size_t)1 << MinBucketSizeExp;
-    if (Size < MinBucketSize) {
-        return 0;
+    void *NewPtr = allocate(Size, FromPool);
+    if (!NewPtr) {
+        return nullptr;
     }
 
-    // Get the position of the leftmost set bit.
-    size_t position = getLeftmostSetBitPos(Size);
+    std::memcpy(NewPtr, Ptr, std::min(OldSize, Size));
 
-    auto isPowerOf2 = 0 == (Size & (Size - 1));
-    auto largerThanHalfwayBetweenPowersOf2 =
-        !isPowerOf2 & bool((Size - 1) & (uint64_t(1) << (position - 1)));
-    auto index = (position - MinBucketSizeExp) * 2 + !isPowerOf2 +
-                 largerThanHalfwayBetweenPowersOf2;
+    // An error is ignored, the data has already been moved, so the new
+    // allocation is valid.
+    deallocate(Ptr, ToPool);
 
-    return index;
+    return NewPtr;
 }
 
-Bucket &DisjointPool::AllocImpl::findBucket(size_t Size) {
-    auto calculatedIdx = sizeToIdx(Size);
-    assert(calculatedIdx >= 0);
-    assert((*(Buckets[calculatedIdx])).getSize() >= Size);
-    if (calculatedIdx > 0) {
-        assert((*(Buckets[calculatedIdx - 1])).getSize() < Size);
+size_t DisjointPool::AllocImpl::getUsableSize(void *Ptr) {
+    if (auto *Slab = findSlab(Ptr)) {
+        return Slab->getUsableSize(Ptr);
     }
 
-    return *(Buckets[calculatedIdx]);
+    return getLargeAllocSize(Ptr);
 }
 
-void DisjointPool::AllocImpl::deallocate(void *Ptr, bool &ToPool) {
-    auto *SlabPtr = AlignPtrDown(Ptr, SlabMinSize());
-
-    // Lock the map on read
-    std::shared_lock<std::shared_timed_mutex> Lk(getKnownSlabsMapLock());
+void DisjointPool::AllocImpl::printStats(bool &TitlePrinted,
+                                         size_t &HighBucketSize,
+                                         size_t &HighPeakSlabsInUse,
+                                         const std::string &MTName) {
+    HighBucketSize = 0;
+    HighPeakSlabsInUse = 0;
+    for (size_t Idx = 0; Idx < NumBuckets; Idx++) {
+        auto &B = Buckets[Idx];
+        (*B).printStats(TitlePrinted, MTName);
 
-    ToPool = false;
-    auto Slabs = getKnownSlabs().equal_range(SlabPtr);
-    if (Slabs.first == Slabs.second) {
-        Lk.unlock();
-        memoryProviderFree(getMemHandle(), Ptr);
-        return;
+        umf_disjoint_pool_bucket_stats_t Stats;
+        (*B).getStats(Stats);
+        HighPeakSlabsInUse = std::max(Stats.MaxSlabsInUse, HighPeakSlabsInUse);
+        if (Stats.AllocCount) {
+            HighBucketSize = std::max(Stats.SlabSize, HighBucketSize);
+        }
     }
+}
 
-    for (auto It = Slabs.first; It != Slabs.second; ++It) {
-        // The slab object won't be deleted until it's removed from the map which is
-        // protected by the lock, so it's safe to access it here.
-        auto &Slab = It->second;
-        if (Ptr >= Slab.getPtr() && Ptr < Slab.getEnd()) {
-            // Unlock the map before freeing the chunk, it may be locked on write
-            // there
-            Lk.unlock();
-            auto &Bucket = Slab.getBucket();
+void DisjointPool::AllocImpl::getStats(umf_disjoint_pool_stats_t &Stats) {
+    Stats = {};
+    Stats.NumBuckets = NumBuckets;
+    for (size_t Idx = 0; Idx < NumBuckets; Idx++) {
+        umf_disjoint_pool_bucket_stats_t BucketStats;
+        Buckets[Idx]->getStats(BucketStats);
+        Stats.AllocCount += BucketStats.AllocCount;
+        Stats.FreeCount += BucketStats.FreeCount;
+        Stats.AllocPoolCount += BucketStats.AllocPoolCount;
+        Stats.SlabsInUse += BucketStats.SlabsInUse;
+        Stats.SlabsInPool += BucketStats.SlabsInPool;
+        Stats.ProviderAllocatedSize += BucketStats.ProviderAllocatedSize;
+    }
+    Stats.LargeAllocCount = LargeAllocCount.load(std::memory_order_relaxed);
+    Stats.LargeFreeCount = LargeFreeCount.load(std::memory_order_relaxed);
+    Stats.ProviderAllocatedSize +=
+        LargeAllocatedSize.load(std::memory_order_relaxed);
+    Stats.LargeCachedSize = LargeCachedSize.load(std::memory_order_relaxed);
+    Stats.LargeCacheHitCount =
+        LargeCacheHitCount.load(std::memory_order_relaxed);
+    Stats.MaxPoolableSize = getMaxPoolableSize();
+}
 
-            if (getParams().PoolTrace > 1) {
-                Bucket.countFree();
-            }
+void DisjointPool::AllocImpl::checkSoftLimit() {
+    auto *Limits = getLimits();
+    auto SoftMaxSize = Limits->SoftMaxSize.load(std::memory_order_relaxed);
+    if (!SoftMaxSize ||
+        Limits->TotalSize.load(std::memory_order_relaxed) <= SoftMaxSize) {
+        return;
+    }
 
-            if (Bucket.getSize() <= Bucket.ChunkCutOff()) {
-                Bucket.freeChunk(Ptr, Slab, ToPool);
-            } else {
-                Bucket.freeSlab(Slab, ToPool);
-            }
+    // A single thread reclaims the memory of all the pools at a time.
+    std::unique_lock<std::mutex> Lk(Limits->Lock, std::try_to_lock);
+    if (!Lk) {
+        return;
+    }
+    size_t TotalSize = Limits->TotalSize;
+    if (TotalSize <= SoftMaxSize) {
+        return;
+    }
+    size_t Excess = TotalSize - SoftMaxSize;
+
+    // Free the least recently pooled slabs until the pools are back to the
+    // soft limit, a bounded number of them at a time.
+    size_t Reclaimed = 0;
+    while (Reclaimed < Excess) {
+        // Find the time at which the least recently pooled slabs, which are
+        // enough to get back to the soft limit, were pooled.
+        OldestPooledSlabs Oldest;
+        for (auto *Pool = Limits->Pools; Pool; Pool = Pool->LimitsNext) {
+            Pool->collectPooled(Oldest);
+        }
+        if (Oldest.empty()) {
+            break;
+        }
+        auto PooledBefore = Oldest.pooledBefore(Excess - Reclaimed);
 
-            return;
+        size_t Trimmed = 0;
+        for (auto *Pool = Limits->Pools; Pool && Reclaimed + Trimmed < Excess;
+             Pool = Pool->LimitsNext) {
+            Trimmed +=
+                Pool->trimPooled(PooledBefore, Excess - Reclaimed - Trimmed);
         }
+        if (!Trimmed) {
+            break;
+        }
+        Reclaimed += Trimmed;
     }
 
+    auto ReclaimCb = Limits->ReclaimCb;
+    auto ReclaimArg = Limits->ReclaimArg;
     Lk.unlock();
-    // There is a rare case when we have a pointer from system allocation next
-    // to some slab with an entry in the map. So we find a slab
-    // but the range checks fail.
-    memoryProviderFree(getMemHandle(), Ptr);
+    if (ReclaimCb) {
+        ReclaimCb(ReclaimArg, Reclaimed, Limits->TotalSize.load());
+    }
 }
 
-void DisjointPool::AllocImpl::printStats(bool &TitlePrinted,
-                                         size_t &HighBucketSize,
-                                         size_t &HighPeakSlabsInUse,
-                                         const std::string &MTName) {
-    HighBucketSize = 0;
-    HighPeakSlabsInUse = 0;
-    for (auto &B : Buckets) {
-        (*B).printStats(TitlePrinted, MTName);
-        HighPeakSlabsInUse = std::max((*B).maxSlabsInUse, HighPeakSlabsInUse);
-        if ((*B).allocCount) {
-            HighBucketSize = std::max((*B).SlabAllocSize(), HighBucketSize);
-        }
+void DisjointPool::AllocImpl::collectPooled(OldestPooledSlabs &Oldest) {
+    for (size_t Idx = 0; Idx < NumBuckets; Idx++) {
+        Buckets[Idx]->collectPooled(Oldest);
+    }
+}
+
+size_t DisjointPool::AllocImpl::trimPooled(uint64_t PooledBefore,
+                                           size_t MaxSize) {
+    size_t Freed = 0;
+    for (size_t Idx = 0; Idx < NumBuckets && Freed < MaxSize; Idx++) {
+        Freed += Buckets[Idx]->trimPooled(PooledBefore, MaxSize - Freed);
+    }
+    return Freed;
+}
+
+umf_result_t DisjointPool::AllocImpl::getBucketStats(
+    size_t BucketIdx, umf_disjoint_pool_bucket_stats_t &Stats) {
+    if (BucketIdx >= NumBuckets) {
+        return UMF_RESULT_ERROR_INVALID_ARGUMENT;
     }
+
+    Buckets[BucketIdx]->getStats(Stats);
+    return UMF_RESULT_SUCCESS;
 }
 
 umf_result_t DisjointPool::initialize(umf_memory_provider_handle_t provider,
@@ -972,9 +4037,31 @@ umf_result_t DisjointPool::initialize(umf_memory_provider_handle_t provider,
         !((parameters->MinBucketSize & (parameters->MinBucketSize - 1)) == 0)) {
         return UMF_RESULT_ERROR_INVALID_ARGUMENT;
     }
+    if (parameters->SizeClassesPerDoubling &
+        (parameters->SizeClassesPerDoubling - 1)) {
+        return UMF_RESULT_ERROR_INVALID_ARGUMENT;
+    }
+    if (parameters->SizeClasses || parameters->NumSizeClasses) {
+        if (!parameters->SizeClasses || !parameters->NumSizeClasses) {
+            return UMF_RESULT_ERROR_INVALID_ARGUMENT;
+        }
+        for (size_t i = 0; i < parameters->NumSizeClasses; i++) {
+            // Chunks are only aligned to the size of their bucket.
+            if (!parameters->SizeClasses[i] ||
+                parameters->SizeClasses[i] > CutOff ||
+                parameters->SizeClasses[i] %
+                    UMF_DISJOINT_POOL_MIN_BUCKET_DEFAULT_SIZE) {
+                return UMF_RESULT_ERROR_INVALID_ARGUMENT;
+            }
+        }
+    }
 
-    impl = std::make_unique<AllocImpl>(provider, parameters);
-    return UMF_RESULT_SUCCESS;
+    impl.reset(new (std::nothrow) AllocImpl(provider, parameters));
+    if (!impl) {
+        return UMF_RESULT_ERROR_OUT_OF_HOST_MEMORY;
+    }
+
+    return impl->init();
 }
 
 void *DisjointPool::malloc(size_t size) { // For full-slab allocations indicates
@@ -991,16 +4078,34 @@ void *DisjointPool::malloc(size_t size) { // For full-slab allocations indicates
     return Ptr;
 }
 
-void *DisjointPool::calloc(size_t, size_t) {
-    // Not supported
-    umf::getPoolLastStatusRef<DisjointPool>() = UMF_RESULT_ERROR_NOT_SUPPORTED;
-    return NULL;
+void *DisjointPool::calloc(size_t num, size_t size) {
+    if (num && size > std::numeric_limits<size_t>::max() / num) {
+        umf::getPoolLastStatusRef<DisjointPool>() =
+            UMF_RESULT_ERROR_OUT_OF_HOST_MEMORY;
+        return nullptr;
+    }
+
+    bool FromPool;
+    auto Ptr = impl->allocateZeroed(num * size, FromPool);
+
+    if (impl->getParams().PoolTrace > 2) {
+        auto MT = impl->getParams().Name;
+        std::cout << "Allocated " << std::setw(8) << num * size << " " << MT
+                  << " zeroed bytes from " << (FromPool ? "Pool" : "Provider")
+                  << " ->" << Ptr << std::endl;
+    }
+    return Ptr;
 }
 
-void *DisjointPool::realloc(void *, size_t) {
-    // Not supported
-    umf::getPoolLastStatusRef<DisjointPool>() = UMF_RESULT_ERROR_NOT_SUPPORTED;
-    return NULL;
+void *DisjointPool::realloc(void *ptr, size_t size) {
+    auto NewPtr = impl->reallocate(ptr, size);
+
+    if (impl->getParams().PoolTrace > 2) {
+        auto MT = impl->getParams().Name;
+        std::cout << "Reallocated " << ptr << " to " << std::setw(8) << size
+                  << " " << MT << " bytes ->" << NewPtr << std::endl;
+    }
+    return NewPtr;
 }
 
 void *DisjointPool::aligned_malloc(size_t size, size_t alignment) {
@@ -1017,14 +4122,28 @@ void *DisjointPool::aligned_malloc(size_t size, size_t alignment) {
     return Ptr;
 }
 
-size_t DisjointPool::malloc_usable_size(void *) {
-    // Not supported
-    return 0;
+size_t DisjointPool::malloc_usable_size(void *ptr) {
+    if (!ptr) {
+        return 0;
+    }
+    return impl->getUsableSize(ptr);
+}
+
+umf_result_t DisjointPool::free(void *ptr) {
+    // The size is not known
+    return free_sized(ptr, 0);
 }
 
-umf_result_t DisjointPool::free(void *ptr) try {
+umf_result_t DisjointPool::free_sized(void *ptr, size_t size) {
     bool ToPool;
-    impl->deallocate(ptr, ToPool);
+    auto Ret = impl->deallocate(ptr, ToPool, size);
+    if (Ret != UMF_RESULT_SUCCESS) {
+        return Ret;
+    }
+
+    if (ToPool) {
+        impl->checkSoftLimit();
+    }
 
     if (impl->getParams().PoolTrace > 2) {
         auto MT = impl->getParams().Name;
@@ -1036,14 +4155,22 @@ umf_result_t DisjointPool::free(void *ptr) try {
                   << impl->getParams().CurPoolSize << "\n";
     }
     return UMF_RESULT_SUCCESS;
-} catch (MemoryProviderError &e) {
-    return e.code;
 }
 
 umf_result_t DisjointPool::get_last_allocation_error() {
     return umf::getPoolLastStatusRef<DisjointPool>();
 }
 
+void DisjointPool::getStats(umf_disjoint_pool_stats_t *Stats) {
+    impl->getStats(*Stats);
+}
+
+umf_result_t
+DisjointPool::getBucketStats(size_t BucketIdx,
+                             umf_disjoint_pool_bucket_stats_t *Stats) {
+    return impl->getBucketStats(BucketIdx, *Stats);
+}
+
 DisjointPool::DisjointPool() {}
 
 // Define destructor for use with unique_ptr
@@ -1051,20 +4178,17 @@ DisjointPool::~DisjointPool() {
     bool TitlePrinted = false;
     size_t HighBucketSize;
     size_t HighPeakSlabsInUse;
-    if (impl->getParams().PoolTrace > 1) {
+    if (impl && impl->getParams().PoolTrace > 1) {
         auto name = impl->getParams().Name;
-        try { // cannot throw in destructor
-            impl->printStats(TitlePrinted, HighBucketSize, HighPeakSlabsInUse,
-                             name);
-            if (TitlePrinted) {
-                std::cout << "Current Pool Size "
-                          << impl->getLimits()->TotalSize.load() << std::endl;
-                std::cout << "Suggested Setting=;"
-                          << std::string(1, tolower(name[0]))
-                          << std::string(name + 1) << ":" << HighBucketSize
-                          << "," << HighPeakSlabsInUse << ",64K" << std::endl;
-            }
-        } catch (...) { // ignore exceptions
+        impl->printStats(TitlePrinted, HighBucketSize, HighPeakSlabsInUse,
+                         name);
+        if (TitlePrinted) {
+            std::cout << "Current Pool Size "
+                      << impl->getLimits()->TotalSize.load() << std::endl;
+            std::cout << "Suggested Setting=;"
+                      << std::string(1, tolower(name[0]))
+                      << std::string(name + 1) << ":" << HighBucketSize << ","
+                      << HighPeakSlabsInUse << ",64K" << std::endl;
         }
     }
 }
@@ -1075,3 +4199,34 @@ static umf_memory_pool_ops_t UMF_DISJOINT_POOL_OPS =
 umf_memory_pool_ops_t *umfDisjointPoolOps(void) {
     return &UMF_DISJOINT_POOL_OPS;
 }
+
+// Get the disjoint pool behind a pool handle, nullptr if the pool is not
+// a disjoint pool.
+static DisjointPool *getDisjointPool(umf_memory_pool_handle_t hPool) {
+    if (!hPool || hPool->ops.initialize != UMF_DISJOINT_POOL_OPS.initialize) {
+        return nullptr;
+    }
+    return static_cast<DisjointPool *>(hPool->pool_priv);
+}
+
+umf_result_t umfDisjointPoolGetStats(umf_memory_pool_handle_t hPool,
+                                     umf_disjoint_pool_stats_t *Stats) {
+    auto *Pool = getDisjointPool(hPool);
+    if (!Pool || !Stats) {
+        return UMF_RESULT_ERROR_INVALID_ARGUMENT;
+    }
+
+    Pool->getStats(Stats);
+    return UMF_RESULT_SUCCESS;
+}
+
+umf_result_t
+umfDisjointPoolGetBucketStats(umf_memory_pool_handle_t hPool, size_t BucketIdx,
+                              umf_disjoint_pool_bucket_stats_t *Stats) {
+    auto *Pool = getDisjointPool(hPool);
+    if (!Pool || !Stats) {
+        return UMF_RESULT_ERROR_INVALID_ARGUMENT;
+    }
+
+    return Pool->getBucketStats(BucketIdx, Stats);
+}
@@ -296,6 +296,18 @@ static umf_result_t je_free(void *pool, void *ptr) {
     return UMF_RESULT_SUCCESS;
 }
 
+static umf_result_t je_free_sized(void *pool, void *ptr, size_t size) {
+    (void)pool; // unused
+    assert(pool);
+
+    // sized deallocation lets jemalloc skip the lookup of the size class
+    if (ptr != NULL) {
+        sdallocx(ptr, size, MALLOCX_TCACHE_NONE);
+    }
+
+    return UMF_RESULT_SUCCESS;
+}
+
 static void *je_calloc(void *pool, size_t num, size_t size) {
     assert(pool);
     size_t csize = num * size;
@@ -430,6 +442,7 @@ static umf_memory_pool_ops_t UMF_JEMALLOC_POOL_OPS = {
     .malloc_usable_size = je_malloc_usable_size,
     .free = je_free,
     .get_last_allocation_error = je_get_last_allocation_error,
+    .free_sized = je_free_sized,
 };
 
 umf_memory_pool_ops_t *umfJemallocPoolOps(void) {
@@ -96,6 +96,14 @@ static umf_result_t proxy_free(void *pool, void *ptr) {
     return umfMemoryProviderFree(hPool->hProvider, ptr, 0);
 }
 
+static umf_result_t proxy_free_sized(void *pool, void *ptr, size_t size) {
+    assert(pool);
+
+    // The provider gets the size of the allocation it made
+    struct proxy_memory_pool *hPool = (struct proxy_memory_pool *)pool;
+    return umfMemoryProviderFree(hPool->hProvider, ptr, size);
+}
+
 static size_t proxy_malloc_usable_size(void *pool, void *ptr) {
     assert(pool);
 
@@ -121,6 +129,7 @@ static umf_memory_pool_ops_t UMF_PROXY_POOL_OPS = {
     .aligned_malloc = proxy_aligned_malloc,
     .malloc_usable_size = proxy_malloc_usable_size,
     .free = proxy_free,
-    .get_last_allocation_error = proxy_get_last_allocation_error};
+    .get_last_allocation_error = proxy_get_last_allocation_error,
+    .free_sized = proxy_free_sized};
 
 umf_memory_pool_ops_t *umfProxyPoolOps(void) { return &UMF_PROXY_POOL_OPS; }
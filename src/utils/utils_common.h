@@ -61,6 +61,29 @@ static inline int is_running_in_proxy_lib(void) {
 
 size_t util_get_page_size(void);
 
+// util_get_numa_nodes_count - return the number of NUMA nodes in the system,
+//                             1 if it cannot be determined
+size_t util_get_numa_nodes_count(void);
+
+// util_get_current_cpu_and_node - get the id and the NUMA node of the CPU
+//                                 the calling thread is running on, 0 for
+//                                 the ones which cannot be determined
+void util_get_current_cpu_and_node(size_t *cpu, size_t *node);
+
+// util_map_shared_memory - map size bytes of the named shared memory object,
+//                          creating it zero-filled if it does not exist, or
+//                          of an anonymous mapping shared with the child
+//                          processes if name is NULL. Returns NULL on failure
+void *util_map_shared_memory(const char *name, size_t size);
+
+// util_unmap_shared_memory - unmap memory mapped by util_map_shared_memory
+void util_unmap_shared_memory(void *addr, size_t size);
+
+// util_unlink_shared_memory - remove the name of a shared memory object, the
+//                             object is destroyed once no process maps it.
+//                             Returns 0 on success
+int util_unlink_shared_memory(const char *name);
+
 #define NOFUNCTION                                                             \
     do {                                                                       \
     } while (0)
@@ -9,6 +9,11 @@
 
 #include <assert.h>
 #include <stddef.h>
+#include <stdint.h>
+
+#if defined(_WIN32)
+#include <intrin.h>
+#endif
 
 #ifdef __cplusplus
 extern "C" {
@@ -19,6 +24,21 @@ size_t getLeftmostSetBitPos(size_t num);
 // Logarithm is an index of the most significant non-zero bit.
 static inline size_t log2Utils(size_t num) { return getLeftmostSetBitPos(num); }
 
+// Retrieves the position of the rightmost set bit.
+// The position of the bit is counted from 0
+// e.g. for 01000011000 the position equals 3.
+static inline size_t getRightmostSetBitPos(uint64_t num) {
+    assert(num != 0 &&
+           "Finding rightmost set bit when number equals zero is undefined");
+#if defined(_WIN32)
+    unsigned long index = 0;
+    _BitScanForward64(&index, num);
+    return (size_t)index;
+#else
+    return (size_t)__builtin_ctzll(num);
+#endif
+}
+
 #ifdef __cplusplus
 }
 #endif
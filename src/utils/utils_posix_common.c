@@ -7,16 +7,29 @@
  *
  */
 
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/syscall.h>
 #include <unistd.h>
 
+#include "utils_common.h"
 #include "utils_concurrency.h"
 
 static UTIL_ONCE_FLAG Page_size_is_initialized = UTIL_ONCE_FLAG_INIT;
 static size_t Page_size;
 
+static UTIL_ONCE_FLAG Numa_nodes_count_is_initialized = UTIL_ONCE_FLAG_INIT;
+static size_t Numa_nodes_count;
+
 int util_env_var(const char *envvar, char *buffer, size_t buffer_size) {
     char *value = getenv(envvar);
     if (!value) {
@@ -50,3 +63,84 @@ size_t util_get_page_size(void) {
     util_init_once(&Page_size_is_initialized, _util_get_page_size);
     return Page_size;
 }
+
+static void _util_get_numa_nodes_count(void) {
+    Numa_nodes_count = 1;
+
+#ifdef __linux__
+    // the file contains a range of node ids, e.g. "0-3" or just "0"
+    FILE *file = fopen("/sys/devices/system/node/possible", "r");
+    if (!file) {
+        return;
+    }
+
+    char buffer[64];
+    if (fgets(buffer, sizeof(buffer), file)) {
+        char *last = strrchr(buffer, '-');
+        last = last ? last + 1 : buffer;
+        long max_node = strtol(last, NULL, 10);
+        if (max_node > 0) {
+            Numa_nodes_count = (size_t)max_node + 1;
+        }
+    }
+
+    fclose(file);
+#endif
+}
+
+size_t util_get_numa_nodes_count(void) {
+    util_init_once(&Numa_nodes_count_is_initialized,
+                   _util_get_numa_nodes_count);
+    return Numa_nodes_count;
+}
+
+void util_get_current_cpu_and_node(size_t *cpu, size_t *node) {
+    *cpu = 0;
+    *node = 0;
+#ifdef __linux__
+    unsigned c, n;
+#if defined(__GLIBC__) &&                                                      \
+    (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 29))
+    // served by vDSO, without entering the kernel
+    if (getcpu(&c, &n) == 0) {
+        *cpu = c;
+        *node = n;
+    }
+#elif defined(SYS_getcpu)
+    if (syscall(SYS_getcpu, &c, &n, NULL) == 0) {
+        *cpu = c;
+        *node = n;
+    }
+#endif
+#endif
+}
+
+void *util_map_shared_memory(const char *name, size_t size) {
+    void *addr;
+    if (!name) {
+        addr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        return addr == MAP_FAILED ? NULL : addr;
+    }
+
+    int fd = shm_open(name, O_RDWR | O_CREAT, 0600);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    // Only a new object is extended, an existing one keeps its contents
+    struct stat st;
+    if (fstat(fd, &st) != 0 ||
+        (st.st_size < (off_t)size && ftruncate(fd, (off_t)size) != 0)) {
+        close(fd);
+        return NULL;
+    }
+
+    addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    return addr == MAP_FAILED ? NULL : addr;
+}
+
+void util_unmap_shared_memory(void *addr, size_t size) { munmap(addr, size); }
+
+int util_unlink_shared_memory(const char *name) { return shm_unlink(name); }
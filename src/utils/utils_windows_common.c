@@ -46,3 +46,48 @@ size_t util_get_page_size(void) {
     util_init_once(&Page_size_is_initialized, _util_get_page_size);
     return Page_size;
 }
+
+size_t util_get_numa_nodes_count(void) {
+    ULONG highest_node;
+    if (!GetNumaHighestNodeNumber(&highest_node)) {
+        return 1;
+    }
+
+    return (size_t)highest_node + 1;
+}
+
+void util_get_current_cpu_and_node(size_t *cpu, size_t *node) {
+    PROCESSOR_NUMBER processor;
+    USHORT n;
+
+    // Each processor group has up to 64 processors
+    GetCurrentProcessorNumberEx(&processor);
+    *cpu = (size_t)processor.Group * 64 + processor.Number;
+    *node = GetNumaProcessorNodeEx(&processor, &n) ? n : 0;
+}
+
+void *util_map_shared_memory(const char *name, size_t size) {
+    HANDLE mapping =
+        CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+                           (DWORD)((uint64_t)size >> 32), (DWORD)size, name);
+    if (!mapping) {
+        return NULL;
+    }
+
+    // The view keeps the mapping object alive
+    void *addr = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+    CloseHandle(mapping);
+    return addr;
+}
+
+void util_unmap_shared_memory(void *addr, size_t size) {
+    (void)size;
+    UnmapViewOfFile(addr);
+}
+
+int util_unlink_shared_memory(const char *name) {
+    // Mapping objects are destroyed with their last view, names don't
+    // outlive them.
+    (void)name;
+    return 0;
+}
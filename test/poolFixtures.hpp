@@ -107,6 +107,17 @@ TEST_P(umfPoolTest, allocFreeNonAlignedSizes) {
     }
 }
 
+TEST_P(umfPoolTest, allocFreeSized) {
+    for (size_t allocSize : {size_t(1), size_t(64), size_t(4096 + 1),
+                             size_t(2 * 1024 * 1024)}) {
+        auto *ptr = umfPoolMalloc(pool.get(), allocSize);
+        ASSERT_NE(ptr, nullptr);
+        std::memset(ptr, 0, allocSize);
+        ASSERT_EQ(umfPoolFreeSized(pool.get(), ptr, allocSize),
+                  UMF_RESULT_SUCCESS);
+    }
+}
+
 TEST_P(umfPoolTest, reallocFree) {
     if (!umf_test::isReallocSupported(pool.get())) {
         GTEST_SKIP();
@@ -9,6 +9,20 @@
 #include "provider_null.h"
 #include "provider_trace.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <thread>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
 umf_disjoint_pool_params_t poolConfig() {
     umf_disjoint_pool_params_t config{};
     config.SlabMinSize = 4096;
@@ -18,6 +32,106 @@ umf_disjoint_pool_params_t poolConfig() {
     return config;
 }
 
+// Calls of the counting_provider and the paged_provider, reset by the tests
+// which check them.
+struct provider_calls_t {
+    std::atomic<size_t> allocs{0};
+    std::atomic<size_t> frees{0};
+    std::atomic<size_t> splits{0};
+    std::atomic<size_t> merges{0};
+
+    // The merge with this number fails, 0 if all of them succeed.
+    size_t failedMerge = 0;
+
+    void reset() {
+        allocs = frees = splits = merges = 0;
+        failedMerge = 0;
+    }
+};
+static provider_calls_t providerCalls;
+
+// Malloc provider which counts its allocations and frees.
+struct counting_provider : public umf_test::provider_malloc {
+    umf_result_t alloc(size_t size, size_t align, void **ptr) noexcept {
+        providerCalls.allocs++;
+        return provider_malloc::alloc(size, align, ptr);
+    }
+    umf_result_t free(void *ptr, size_t size) noexcept {
+        providerCalls.frees++;
+        return provider_malloc::free(ptr, size);
+    }
+};
+
+// Hands out consecutive pages of a single buffer, so that subsequent
+// allocations are adjacent, and split or merged parts of allocations can be
+// freed separately. Splits and merges are only counted.
+struct paged_provider : public umf_test::provider_base_t {
+    static constexpr size_t pageSize = 4096;
+    static constexpr size_t capacity = 64 * pageSize;
+
+    char *base = nullptr;
+    size_t used = 0;
+
+    umf_result_t initialize() noexcept {
+        base = static_cast<char *>(::aligned_alloc(pageSize, capacity));
+        return base ? UMF_RESULT_SUCCESS : UMF_RESULT_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    ~paged_provider() { ::free(base); }
+
+    umf_result_t alloc(size_t size, size_t, void **ptr) noexcept {
+        size = ALIGN_UP(size, pageSize);
+        if (used + size > capacity) {
+            return UMF_RESULT_ERROR_OUT_OF_HOST_MEMORY;
+        }
+        *ptr = base + used;
+        used += size;
+        providerCalls.allocs++;
+        return UMF_RESULT_SUCCESS;
+    }
+    umf_result_t free(void *, size_t) noexcept {
+        providerCalls.frees++;
+        return UMF_RESULT_SUCCESS;
+    }
+    umf_result_t get_min_page_size(void *, size_t *pageSizeOut) noexcept {
+        *pageSizeOut = pageSize;
+        return UMF_RESULT_SUCCESS;
+    }
+};
+
+umf_memory_provider_ops_t pagedProviderOps() {
+    auto ops = umf::providerMakeCOps<paged_provider, void>();
+    ops.allocation_split = [](void *, void *, size_t, size_t) {
+        providerCalls.splits++;
+        return UMF_RESULT_SUCCESS;
+    };
+    ops.allocation_merge = [](void *, void *, void *, size_t) {
+        return ++providerCalls.merges == providerCalls.failedMerge
+                   ? UMF_RESULT_ERROR_UNKNOWN
+                   : UMF_RESULT_SUCCESS;
+    };
+    return ops;
+}
+
+umf_disjoint_pool_stats_t getPoolStats(umf_memory_pool_handle_t pool) {
+    umf_disjoint_pool_stats_t stats;
+    EXPECT_EQ(umfDisjointPoolGetStats(pool, &stats), UMF_RESULT_SUCCESS);
+    return stats;
+}
+
+// Statistics of the bucket of the given size.
+umf_disjoint_pool_bucket_stats_t getBucketStats(umf_memory_pool_handle_t pool,
+                                                size_t size) {
+    umf_disjoint_pool_bucket_stats_t bucketStats{};
+    for (size_t i = 0; i < getPoolStats(pool).NumBuckets; i++) {
+        EXPECT_EQ(umfDisjointPoolGetBucketStats(pool, i, &bucketStats),
+                  UMF_RESULT_SUCCESS);
+        if (bucketStats.BucketSize == size) {
+            break;
+        }
+    }
+    return bucketStats;
+}
+
 using umf_test::test;
 using namespace umf_test;
 
@@ -70,6 +184,38 @@ TEST_F(test, freeErrorPropagation) {
     EXPECT_EQ(testResult, expectedResult);
 }
 
+TEST_F(test, allocErrorPropagation) {
+    static constexpr umf_result_t providerError =
+        UMF_RESULT_ERROR_MEMORY_PROVIDER_SPECIFIC;
+    struct memory_provider : public umf_test::provider_base_t {
+        umf_result_t alloc(size_t, size_t, void **) noexcept {
+            return providerError;
+        }
+    };
+    umf_memory_provider_ops_t provider_ops =
+        umf::providerMakeCOps<memory_provider, void>();
+
+    auto providerUnique =
+        wrapProviderUnique(createProviderChecked(&provider_ops, nullptr));
+
+    auto config = poolConfig();
+    umf_memory_pool_handle_t pool = NULL;
+    auto ret = umfPoolCreate(umfDisjointPoolOps(), providerUnique.get(),
+                             &config, 0, &pool);
+    ASSERT_EQ(ret, UMF_RESULT_SUCCESS);
+    auto poolHandle = umf_test::wrapPoolUnique(pool);
+
+    // The error of the provider is returned for chunks, full slabs and
+    // allocations above MaxPoolableSize.
+    for (size_t size : {size_t(64), config.SlabMinSize,
+                        2 * config.MaxPoolableSize}) {
+        ASSERT_EQ(umfPoolMalloc(pool, size), nullptr);
+        ASSERT_EQ(umfPoolGetLastAllocationError(pool), providerError);
+        ASSERT_EQ(umfPoolAlignedMalloc(pool, size, 128), nullptr);
+        ASSERT_EQ(umfPoolGetLastAllocationError(pool), providerError);
+    }
+}
+
 TEST_F(test, sharedLimits) {
 #if !UMF_ENABLE_POOL_TRACKING_TESTS
     GTEST_SKIP() << "Pool Tracking needs to be enabled";
@@ -148,21 +294,1735 @@ TEST_F(test, sharedLimits) {
     EXPECT_EQ(MaxSize / SlabMinSize * 2, numFrees);
 }
 
-auto defaultPoolConfig = poolConfig();
-INSTANTIATE_TEST_SUITE_P(disjointPoolTests, umfPoolTest,
-                         ::testing::Values(poolCreateExtParams{
-                             umfDisjointPoolOps(), (void *)&defaultPoolConfig,
-                             &MALLOC_PROVIDER_OPS, nullptr}));
+TEST_F(test, sharedLimitsSoftLimit) {
+    auto ops = umf::providerMakeCOps<umf_test::provider_malloc, void>();
+    auto provider = wrapProviderUnique(createProviderChecked(&ops, nullptr));
 
-INSTANTIATE_TEST_SUITE_P(
-    disjointPoolTests, umfMemTest,
-    ::testing::Values(std::make_tuple(
-        poolCreateExtParams{umfDisjointPoolOps(), (void *)&defaultPoolConfig,
-                            &MOCK_OUT_OF_MEM_PROVIDER_OPS,
-                            (void *)&defaultPoolConfig.Capacity},
-        static_cast<int>(defaultPoolConfig.Capacity) / 2)));
+    static constexpr size_t slabSize = 4096;
+    auto limits =
+        std::unique_ptr<umf_disjoint_pool_shared_limits_t,
+                        decltype(&umfDisjointPoolSharedLimitsDestroy)>(
+            umfDisjointPoolSharedLimitsCreate(16 * slabSize),
+            &umfDisjointPoolSharedLimitsDestroy);
+    ASSERT_EQ(umfDisjointPoolSharedLimitsSetSoftLimit(limits.get(),
+                                                      2 * slabSize),
+              UMF_RESULT_SUCCESS);
 
-INSTANTIATE_TEST_SUITE_P(disjointMultiPoolTests, umfMultiPoolTest,
-                         ::testing::Values(poolCreateExtParams{
-                             umfDisjointPoolOps(), (void *)&defaultPoolConfig,
+    struct reclaim_log_t {
+        size_t calls = 0;
+        size_t reclaimed = 0;
+        size_t totalSize = 0;
+    } reclaimLog;
+    ASSERT_EQ(umfDisjointPoolSharedLimitsSetReclaimCallback(
+                  limits.get(),
+                  [](void *arg, size_t reclaimed, size_t totalSize) {
+                      auto *log = static_cast<reclaim_log_t *>(arg);
+                      log->calls++;
+                      log->reclaimed += reclaimed;
+                      log->totalSize = totalSize;
+                  },
+                  &reclaimLog),
+              UMF_RESULT_SUCCESS);
+
+    auto config = poolConfig();
+    config.SharedLimits = limits.get();
+    umf_memory_pool_handle_t pool1 = NULL;
+    umf_memory_pool_handle_t pool2 = NULL;
+    ASSERT_EQ(umfPoolCreate(umfDisjointPoolOps(), provider.get(),
+                            (void *)&config, 0, &pool1),
+              UMF_RESULT_SUCCESS);
+    auto poolHandle1 = umf_test::wrapPoolUnique(pool1);
+    ASSERT_EQ(umfPoolCreate(umfDisjointPoolOps(), provider.get(),
+                            (void *)&config, 0, &pool2),
+              UMF_RESULT_SUCCESS);
+    auto poolHandle2 = umf_test::wrapPoolUnique(pool2);
+
+    auto slabsInPool = [](umf_memory_pool_handle_t pool) {
+        umf_disjoint_pool_stats_t stats;
+        EXPECT_EQ(umfDisjointPoolGetStats(pool, &stats), UMF_RESULT_SUCCESS);
+        return stats.SlabsInPool;
+    };
+
+    // Free slabs one by one, so that they are pooled at different times
+    auto allocFree = [](umf_memory_pool_handle_t pool, size_t count) {
+        std::vector<void *> ptrs;
+        for (size_t i = 0; i < count; i++) {
+            ptrs.push_back(umfPoolMalloc(pool, slabSize));
+            ASSERT_NE(ptrs.back(), nullptr);
+        }
+        for (auto *ptr : ptrs) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            ASSERT_EQ(umfPoolFree(pool, ptr), UMF_RESULT_SUCCESS);
+        }
+    };
+
+    // The slab pooled first goes back to the provider above the soft limit
+    allocFree(pool1, 3);
+    ASSERT_EQ(slabsInPool(pool1), 2);
+    ASSERT_EQ(reclaimLog.calls, 1);
+    ASSERT_EQ(reclaimLog.reclaimed, slabSize);
+    ASSERT_EQ(reclaimLog.totalSize, 2 * slabSize);
+
+    // Including the slabs of the other pools sharing the limits
+    allocFree(pool2, 1);
+    ASSERT_EQ(slabsInPool(pool1), 1);
+    ASSERT_EQ(slabsInPool(pool2), 1);
+    ASSERT_EQ(reclaimLog.calls, 2);
+    ASSERT_EQ(reclaimLog.reclaimed, 2 * slabSize);
+
+    // Nothing is reclaimed below the soft limit
+    ASSERT_EQ(umfDisjointPoolSharedLimitsSetSoftLimit(limits.get(), 0),
+              UMF_RESULT_SUCCESS);
+    allocFree(pool2, 2);
+    ASSERT_EQ(slabsInPool(pool1) + slabsInPool(pool2), 3);
+    ASSERT_EQ(reclaimLog.calls, 2);
+
+    // Many slabs over the soft limit are all reclaimed at once
+    static constexpr size_t numSlabs = 150;
+    poolHandle1.reset();
+    poolHandle2.reset();
+    auto manyLimits =
+        std::unique_ptr<umf_disjoint_pool_shared_limits_t,
+                        decltype(&umfDisjointPoolSharedLimitsDestroy)>(
+            umfDisjointPoolSharedLimitsCreate(numSlabs * slabSize),
+            &umfDisjointPoolSharedLimitsDestroy);
+    config.SharedLimits = manyLimits.get();
+    config.Capacity = numSlabs;
+    ASSERT_EQ(umfPoolCreate(umfDisjointPoolOps(), provider.get(),
+                            (void *)&config, 0, &pool1),
+              UMF_RESULT_SUCCESS);
+    poolHandle1 = umf_test::wrapPoolUnique(pool1);
+    ASSERT_EQ(umfDisjointPoolSharedLimitsSetSoftLimit(manyLimits.get(),
+                                                      numSlabs * slabSize),
+              UMF_RESULT_SUCCESS);
+    allocFree(pool1, numSlabs);
+    ASSERT_EQ(slabsInPool(pool1), numSlabs);
+    ASSERT_EQ(umfDisjointPoolSharedLimitsSetSoftLimit(manyLimits.get(),
+                                                      2 * slabSize),
+              UMF_RESULT_SUCCESS);
+    allocFree(pool1, 1);
+    ASSERT_EQ(slabsInPool(pool1), 2);
+
+    ASSERT_EQ(umfDisjointPoolSharedLimitsSetSoftLimit(nullptr, 0),
+              UMF_RESULT_ERROR_INVALID_ARGUMENT);
+}
+
+#ifdef __linux__
+TEST_F(test, sharedLimitsAcrossProcesses) {
+    providerCalls.reset();
+    umf_memory_provider_ops_t provider_ops =
+        umf::providerMakeCOps<counting_provider, void>();
+
+    static constexpr size_t SlabMinSize = 4096;
+    static constexpr size_t MaxSize = 2 * SlabMinSize;
+
+    auto config = poolConfig();
+    config.SlabMinSize = SlabMinSize;
+
+    using limits_unique_t =
+        std::unique_ptr<umf_disjoint_pool_shared_limits_t,
+                        decltype(&umfDisjointPoolSharedLimitsDestroy)>;
+    auto provider =
+        wrapProviderUnique(createProviderChecked(&provider_ops, nullptr));
+
+    auto createPool = [&](umf_disjoint_pool_shared_limits_t *limits) {
+        config.SharedLimits = limits;
+        umf_memory_pool_handle_t pool = NULL;
+        auto ret = umfPoolCreate(umfDisjointPoolOps(), provider.get(),
+                                 (void *)&config, 0, &pool);
+        EXPECT_EQ(ret, UMF_RESULT_SUCCESS);
+        return umf_test::wrapPoolUnique(pool);
+    };
+
+    // Pool MaxSize in the first pool, slabs freed by the second one can't
+    // be pooled anymore.
+    auto fillAndCheck = [&](umf_memory_pool_handle_t pool1,
+                            umf_memory_pool_handle_t pool2) {
+        std::vector<void *> ptrs;
+        for (size_t i = 0; i < MaxSize / SlabMinSize; i++) {
+            ptrs.push_back(umfPoolMalloc(pool1, SlabMinSize));
+        }
+        for (auto *ptr : ptrs) {
+            umfPoolFree(pool1, ptr);
+        }
+        EXPECT_EQ(providerCalls.frees, 0);
+
+        umfPoolFree(pool2, umfPoolMalloc(pool2, SlabMinSize));
+        EXPECT_EQ(providerCalls.frees, 1);
+    };
+
+    // Limits opened twice by name share the accounting, the MaxSize of the
+    // creator is used.
+    std::string name = "/umf_test_shared_limits_" + std::to_string(getpid());
+    limits_unique_t limits1(
+        umfDisjointPoolSharedLimitsCreateShared(name.c_str(), MaxSize),
+        &umfDisjointPoolSharedLimitsDestroy);
+    ASSERT_NE(limits1, nullptr);
+    limits_unique_t limits2(
+        umfDisjointPoolSharedLimitsCreateShared(name.c_str(), 0),
+        &umfDisjointPoolSharedLimitsDestroy);
+    ASSERT_NE(limits2, nullptr);
+    ASSERT_EQ(umfDisjointPoolSharedLimitsUnlink(name.c_str()),
+              UMF_RESULT_SUCCESS);
+    EXPECT_EQ(umfDisjointPoolSharedLimitsUnlink(name.c_str()),
+              UMF_RESULT_ERROR_INVALID_ARGUMENT);
+
+    {
+        auto pool1 = createPool(limits1.get());
+        auto pool2 = createPool(limits2.get());
+        fillAndCheck(pool1.get(), pool2.get());
+
+        // Destroying the pools releases their share of the limits.
+        pool1.reset();
+        pool2.reset();
+        providerCalls.frees = 0;
+        pool1 = createPool(limits1.get());
+        pool2 = createPool(limits2.get());
+        fillAndCheck(pool1.get(), pool2.get());
+    }
+
+    // Anonymous limits are shared with the forked processes, memory pooled
+    // by the child stays accounted after it exits.
+    limits_unique_t limits(
+        umfDisjointPoolSharedLimitsCreateShared(NULL, MaxSize),
+        &umfDisjointPoolSharedLimitsDestroy);
+    ASSERT_NE(limits, nullptr);
+    auto pool = createPool(limits.get());
+    providerCalls.frees = 0;
+
+    pid_t pid = fork();
+    ASSERT_NE(pid, -1);
+    if (pid == 0) {
+        std::vector<void *> ptrs;
+        for (size_t i = 0; i < MaxSize / SlabMinSize; i++) {
+            ptrs.push_back(umfPoolMalloc(pool.get(), SlabMinSize));
+        }
+        for (auto *ptr : ptrs) {
+            umfPoolFree(pool.get(), ptr);
+        }
+        _exit(providerCalls.frees == 0 ? 0 : 1);
+    }
+
+    int status = 0;
+    ASSERT_EQ(waitpid(pid, &status, 0), pid);
+    ASSERT_TRUE(WIFEXITED(status));
+    ASSERT_EQ(WEXITSTATUS(status), 0);
+
+    umfPoolFree(pool.get(), umfPoolMalloc(pool.get(), SlabMinSize));
+    EXPECT_EQ(providerCalls.frees, 1);
+
+    // A shared memory object left in the middle of its setup by a process
+    // which died is not waited for forever.
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(ftruncate(fd, sysconf(_SC_PAGESIZE)), 0);
+    auto *state = static_cast<uint32_t *>(mmap(NULL, sysconf(_SC_PAGESIZE),
+                                               PROT_READ | PROT_WRITE,
+                                               MAP_SHARED, fd, 0));
+    close(fd);
+    ASSERT_NE(state, MAP_FAILED);
+    *state = 1; // Initializing
+    EXPECT_EQ(umfDisjointPoolSharedLimitsCreateShared(name.c_str(), MaxSize),
+              nullptr);
+    munmap(state, sysconf(_SC_PAGESIZE));
+    ASSERT_EQ(umfDisjointPoolSharedLimitsUnlink(name.c_str()),
+              UMF_RESULT_SUCCESS);
+}
+#endif
+
+TEST_F(test, threadCacheFlushOnThreadExit) {
+    static size_t numAllocs = 0;
+    static size_t numFrees = 0;
+
+    struct memory_provider : public umf_test::provider_base_t {
+        umf_result_t alloc(size_t size, size_t, void **ptr) noexcept {
+            *ptr = malloc(size);
+            numAllocs++;
+            return UMF_RESULT_SUCCESS;
+        }
+        umf_result_t free(void *ptr, [[maybe_unused]] size_t size) noexcept {
+            ::free(ptr);
+            numFrees++;
+            return UMF_RESULT_SUCCESS;
+        }
+    };
+    umf_memory_provider_ops_t provider_ops =
+        umf::providerMakeCOps<memory_provider, void>();
+
+    auto config = poolConfig();
+    config.ThreadCacheSize = 16;
+
+    auto provider =
+        wrapProviderUnique(createProviderChecked(&provider_ops, nullptr));
+
+    umf_memory_pool_handle_t pool = NULL;
+    auto ret = umfPoolCreate(umfDisjointPoolOps(), provider.get(),
+                             (void *)&config, 0, &pool);
+    ASSERT_EQ(ret, UMF_RESULT_SUCCESS);
+    auto poolHandle = umf_test::wrapPoolUnique(pool);
+
+    static constexpr size_t allocSize = 64;
+    static constexpr size_t numAllocations = 1000;
+
+    // Chunks freed by a thread end up in its cache and have to be returned
+    // to the pool when the thread exits, so that the slabs can be freed.
+    std::thread([pool] {
+        std::vector<void *> ptrs;
+        for (size_t i = 0; i < numAllocations; i++) {
+            ptrs.push_back(umfPoolMalloc(pool, allocSize));
+            ASSERT_NE(ptrs.back(), nullptr);
+        }
+        for (auto ptr : ptrs) {
+            umfPoolFree(pool, ptr);
+        }
+    }).join();
+
+    // At most one empty slab is kept in the pool
+    EXPECT_GE(numFrees + 1, numAllocs);
+
+    // The cache of a thread which outlives the pool is flushed by the pool.
+    void *ptr = umfPoolMalloc(pool, allocSize);
+    ASSERT_NE(ptr, nullptr);
+    umfPoolFree(pool, ptr);
+
+    poolHandle.reset();
+    EXPECT_EQ(numFrees, numAllocs);
+}
+
+TEST_F(test, chunkedSlabsFillAndFree) {
+    auto config = poolConfig();
+    config.MinBucketSize = 8;
+    config.SlabMinSize = 64 * 1024;
+    config.MaxPoolableSize = 64 * 1024;
+
+    auto provider = wrapProviderUnique(
+        createProviderChecked(&MALLOC_PROVIDER_OPS, nullptr));
+
+    umf_memory_pool_handle_t pool = NULL;
+    auto ret = umfPoolCreate(umfDisjointPoolOps(), provider.get(),
+                             (void *)&config, 0, &pool);
+    ASSERT_EQ(ret, UMF_RESULT_SUCCESS);
+    auto poolHandle = umf_test::wrapPoolUnique(pool);
+
+    // Fill a few slabs of the smallest bucket, free the chunks in random
+    // order and allocate them again.
+    static constexpr size_t allocSize = 8;
+    const size_t numAllocs = 3 * config.SlabMinSize / allocSize;
+
+    std::vector<void *> ptrs;
+    for (size_t i = 0; i < numAllocs; i++) {
+        ptrs.push_back(umfPoolMalloc(pool, allocSize));
+        ASSERT_NE(ptrs.back(), nullptr);
+        *static_cast<size_t *>(ptrs.back()) = i;
+    }
+
+    std::vector<void *> sorted(ptrs);
+    std::sort(sorted.begin(), sorted.end());
+    ASSERT_EQ(std::adjacent_find(sorted.begin(), sorted.end()), sorted.end());
+
+    std::mt19937_64 g(0);
+    std::shuffle(ptrs.begin(), ptrs.end(), g);
+    for (size_t i = 0; i < numAllocs / 2; i++) {
+        umfPoolFree(pool, ptrs.back());
+        ptrs.pop_back();
+    }
+
+    for (size_t i = 0; i < numAllocs / 2; i++) {
+        ptrs.push_back(umfPoolMalloc(pool, allocSize));
+        ASSERT_NE(ptrs.back(), nullptr);
+    }
+
+    sorted = ptrs;
+    std::sort(sorted.begin(), sorted.end());
+    ASSERT_EQ(std::adjacent_find(sorted.begin(), sorted.end()), sorted.end());
+
+    for (auto ptr : ptrs) {
+        EXPECT_EQ(umfPoolFree(pool, ptr), UMF_RESULT_SUCCESS);
+    }
+}
+
+TEST_F(test, reallocInPlace) {
+    auto config = poolConfig();
+
+    auto provider = wrapProviderUnique(
+        createProviderChecked(&MALLOC_PROVIDER_OPS, nullptr));
+
+    umf_memory_pool_handle_t pool = NULL;
+    auto ret = umfPoolCreate(umfDisjointPoolOps(), provider.get(),
+                             (void *)&config, 0, &pool);
+    ASSERT_EQ(ret, UMF_RESULT_SUCCESS);
+    auto poolHandle = umf_test::wrapPoolUnique(pool);
+
+    // A reallocation which fits in the chunk stays in place
+    auto *ptr = umfPoolMalloc(pool, 70);
+    ASSERT_NE(ptr, nullptr);
+    memset(ptr, 1, 70);
+    ASSERT_EQ(umfPoolRealloc(pool, ptr, 96), ptr);
+    ASSERT_EQ(umfPoolRealloc(pool, ptr, 16), ptr);
+
+    // A larger one moves to another bucket along with its data
+    auto *newPtr = umfPoolRealloc(pool, ptr, 1024);
+    ASSERT_NE(newPtr, nullptr);
+    ASSERT_NE(newPtr, ptr);
+    for (size_t i = 0; i < 70; i++) {
+        ASSERT_EQ(static_cast<char *>(newPtr)[i], 1);
+    }
+
+    // Full slabs are resized in place as well
+    ptr = umfPoolRealloc(pool, newPtr, 3000);
+    ASSERT_NE(ptr, nullptr);
+    ASSERT_EQ(umfPoolRealloc(pool, ptr, config.SlabMinSize), ptr);
+
+    ASSERT_EQ(umfPoolRealloc(pool, ptr, 0), nullptr);
+}
+
+TEST_F(test, mallocUsableSize) {
+    auto config = poolConfig();
+
+    auto provider = wrapProviderUnique(
+        createProviderChecked(&MALLOC_PROVIDER_OPS, nullptr));
+
+    umf_memory_pool_handle_t pool = NULL;
+    auto ret = umfPoolCreate(umfDisjointPoolOps(), provider.get(),
+                             (void *)&config, 0, &pool);
+    ASSERT_EQ(ret, UMF_RESULT_SUCCESS);
+    auto poolHandle = umf_test::wrapPoolUnique(pool);
+
+    ASSERT_EQ(umfPoolMallocUsableSize(pool, nullptr), 0);
+
+    // The whole chunk of the bucket is usable
+    auto *ptr = umfPoolMalloc(pool, 70);
+    ASSERT_NE(ptr, nullptr);
+    ASSERT_EQ(umfPoolMallocUsableSize(pool, ptr), 96);
+    ASSERT_EQ(umfPoolRealloc(pool, ptr, 96), ptr);
+    ASSERT_EQ(umfPoolFree(pool, ptr), UMF_RESULT_SUCCESS);
+
+    // Except for the alignment offset within the chunk
+    ptr = umfPoolAlignedMalloc(pool, 100, 128);
+    ASSERT_NE(ptr, nullptr);
+    auto usableSize = umfPoolMallocUsableSize(pool, ptr);
+    ASSERT_GE(usableSize, 100);
+    memset(ptr, 0, usableSize);
+    ASSERT_EQ(umfPoolFree(pool, ptr), UMF_RESULT_SUCCESS);
+
+    // The entire slab is usable
+    ptr = umfPoolMalloc(pool, 3000);
+    ASSERT_NE(ptr, nullptr);
+    ASSERT_EQ(umfPoolMallocUsableSize(pool, ptr), config.SlabMinSize);
+    ASSERT_EQ(umfPoolFree(pool, ptr), UMF_RESULT_SUCCESS);
+
+    // Allocations from the provider have their own sizes
+    ptr = umfPoolMalloc(pool, 3 * config.MaxPoolableSize);
+    ASSERT_NE(ptr, nullptr);
+    ASSERT_EQ(umfPoolMallocUsableSize(pool, ptr), 3 * config.MaxPoolableSize);
+    ASSERT_EQ(umfPoolFree(pool, ptr), UMF_RESULT_SUCCESS);
+}
+
+TEST_F(test, sizeClasses) {
+    auto provider = wrapProviderUnique(
+        createProviderChecked(&MALLOC_PROVIDER_OPS, nullptr));
+
+    auto usableSizes = [&](umf_disjoint_pool_params_t &config,
+                           std::vector<size_t> sizes) {
+        umf_memory_pool_handle_t pool = NULL;
+        auto ret = umfPoolCreate(umfDisjointPoolOps(), provider.get(),
+                                 (void *)&config, 0, &pool);
+        EXPECT_EQ(ret, UMF_RESULT_SUCCESS);
+        auto poolHandle = umf_test::wrapPoolUnique(pool);
+
+        std::vector<size_t> usable;
+        for (auto size : sizes) {
+            auto *ptr = umfPoolMalloc(pool, size);
+            EXPECT_NE(ptr, nullptr);
+            usable.push_back(umfPoolMallocUsableSize(pool, ptr));
+            EXPECT_EQ(umfPoolFree(pool, ptr), UMF_RESULT_SUCCESS);
+        }
+        return usable;
+    };
+
+    auto config = poolConfig();
+    ASSERT_EQ(usableSizes(config, {65, 1500}), std::vector<size_t>({96, 1536}));
+
+    config.SizeClassesPerDoubling = 4;
+    ASSERT_EQ(usableSizes(config, {65, 1500}), std::vector<size_t>({80, 1536}));
+
+    config.SizeClassesPerDoubling = 8;
+    ASSERT_EQ(usableSizes(config, {65, 1500}), std::vector<size_t>({72, 1536}));
+
+    // Sizes above the listed ones use the generated classes
+    size_t sizeClasses[] = {296, 104};
+    config.SizeClasses = sizeClasses;
+    config.NumSizeClasses = 2;
+    ASSERT_EQ(usableSizes(config, {50, 105, 297, 1500}),
+              std::vector<size_t>({104, 296, 320, 1536}));
+
+    umf_memory_pool_handle_t pool = NULL;
+    size_t unalignedSizeClasses[] = {96, 100};
+    config.SizeClasses = unalignedSizeClasses;
+    ASSERT_EQ(umfPoolCreate(umfDisjointPoolOps(), provider.get(),
+                            (void *)&config, 0, &pool),
+              UMF_RESULT_ERROR_INVALID_ARGUMENT);
+
+    config.SizeClasses = nullptr;
+    ASSERT_EQ(umfPoolCreate(umfDisjointPoolOps(), provider.get(),
+                            (void *)&config, 0, &pool),
+              UMF_RESULT_ERROR_INVALID_ARGUMENT);
+
+    config.NumSizeClasses = 0;
+    config.SizeClassesPerDoubling = 3;
+    ASSERT_EQ(umfPoolCreate(umfDisjointPoolOps(), provider.get(),
+                            (void *)&config, 0, &pool),
+              UMF_RESULT_ERROR_INVALID_ARGUMENT);
+}
+
+TEST_F(test, sizeClassAlignment) {
+    // Slabs are page-aligned, so that aligned allocations rely on the
+    // alignment of the chunks.
+    struct memory_provider : public umf_test::provider_malloc {
+        umf_result_t alloc(size_t size, size_t, void **ptr) noexcept {
+            return provider_malloc::alloc(size, 4096, ptr);
+        }
+        umf_result_t get_min_page_size(void *, size_t *pageSize) noexcept {
+            *pageSize = 4096;
+            return UMF_RESULT_SUCCESS;
+        }
+    };
+    auto ops = umf::providerMakeCOps<memory_provider, void>();
+    auto provider = wrapProviderUnique(createProviderChecked(&ops, nullptr));
+
+    auto checkAlignment = [&](umf_disjoint_pool_params_t &config) {
+        umf_memory_pool_handle_t pool = NULL;
+        ASSERT_EQ(umfPoolCreate(umfDisjointPoolOps(), provider.get(),
+                                (void *)&config, 0, &pool),
+                  UMF_RESULT_SUCCESS);
+        auto poolHandle = umf_test::wrapPoolUnique(pool);
+
+        // Every bucket up to a slab, two chunks of each
+        for (size_t size = 1; size <= config.SlabMinSize; size++) {
+            void *ptrs[2];
+            for (auto &ptr : ptrs) {
+                ptr = umfPoolMalloc(pool, size);
+                ASSERT_NE(ptr, nullptr);
+                ASSERT_EQ(reinterpret_cast<uintptr_t>(ptr) % 8, 0);
+            }
+            for (auto *ptr : ptrs) {
+                ASSERT_EQ(umfPoolFree(pool, ptr), UMF_RESULT_SUCCESS);
+            }
+
+            for (size_t alignment = 16; alignment <= 256; alignment *= 2) {
+                for (auto &ptr : ptrs) {
+                    ptr = umfPoolAlignedMalloc(pool, size, alignment);
+                    ASSERT_NE(ptr, nullptr);
+                    ASSERT_EQ(reinterpret_cast<uintptr_t>(ptr) % alignment,
+                              0);
+                    ASSERT_GE(umfPoolMallocUsableSize(pool, ptr), size);
+                    memset(ptr, 0, size);
+                }
+                for (auto *ptr : ptrs) {
+                    ASSERT_EQ(umfPoolFree(pool, ptr), UMF_RESULT_SUCCESS);
+                }
+            }
+        }
+    };
+
+    auto config = poolConfig();
+    config.MinBucketSize = 8;
+    for (size_t perDoubling = 1; perDoubling <= 64; perDoubling *= 2) {
+        config.SizeClassesPerDoubling = perDoubling;
+        checkAlignment(config);
+    }
+
+    // Listed sizes which are not multiples of the alignment
+    size_t sizeClasses[] = {24, 40, 104, 296, 1000};
+    config.SizeClassesPerDoubling = 0;
+    config.SizeClasses = sizeClasses;
+    config.NumSizeClasses = sizeof(sizeClasses) / sizeof(sizeClasses[0]);
+    checkAlignment(config);
+}
+
+TEST_F(test, sizeClassAboveChunkCutOff) {
+    auto provider = wrapProviderUnique(
+        createProviderChecked(&MALLOC_PROVIDER_OPS, nullptr));
+
+    // Requests up to SlabMinSize / 2 are served from a bucket that hands out
+    // whole slabs, so they have to be freed as whole slabs as well.
+    size_t sizeClasses[] = {104, 40000};
+    auto config = poolConfig();
+    config.SizeClasses = sizeClasses;
+    config.NumSizeClasses = 2;
+    config.SlabMinSize = 64 * 1024;
+    config.MaxPoolableSize = 2 * 1024 * 1024;
+    umf_memory_pool_handle_t pool = NULL;
+    ASSERT_EQ(umfPoolCreate(umfDisjointPoolOps(), provider.get(),
+                            (void *)&config, 0, &pool),
+              UMF_RESULT_SUCCESS);
+    auto poolHandle = umf_test::wrapPoolUnique(pool);
+
+    for (size_t size : {30000, 40000, 30000}) {
+        std::vector<void *> ptrs;
+        for (int i = 0; i < 3; i++) {
+            auto *ptr = umfPoolMalloc(pool, size);
+            ASSERT_NE(ptr, nullptr);
+            ASSERT_GE(umfPoolMallocUsableSize(pool, ptr), size);
+            for (auto *other : ptrs) {
+                ASSERT_NE(ptr, other);
+            }
+            memset(ptr, 0, size);
+            ptrs.push_back(ptr);
+        }
+        for (auto *ptr : ptrs) {
+            ASSERT_EQ(umfPoolFree(pool, ptr), UMF_RESULT_SUCCESS);
+        }
+    }
+}
+
+TEST_F(test, stats) {
+    static std::atomic<size_t> providerSize;
+
+    struct memory_provider : public umf_test::provider_malloc {
+        umf_result_t alloc(size_t size, size_t align, void **ptr) noexcept {
+            providerSize += size;
+            return provider_malloc::alloc(size, align, ptr);
+        }
+        umf_result_t free(void *ptr, size_t size) noexcept {
+            providerSize -= size;
+            return provider_malloc::free(ptr, size);
+        }
+    };
+    auto ops = umf::providerMakeCOps<memory_provider, void>();
+    auto provider = wrapProviderUnique(createProviderChecked(&ops, nullptr));
+
+    auto config = poolConfig();
+    umf_memory_pool_handle_t pool = NULL;
+    auto ret = umfPoolCreate(umfDisjointPoolOps(), provider.get(),
+                             (void *)&config, 0, &pool);
+    ASSERT_EQ(ret, UMF_RESULT_SUCCESS);
+    auto poolHandle = umf_test::wrapPoolUnique(pool);
+
+    std::vector<void *> ptrs;
+    for (int i = 0; i < 10; i++) {
+        ptrs.push_back(umfPoolMalloc(pool, 64));
+    }
+    ptrs.push_back(umfPoolMalloc(pool, 3000));
+    ptrs.push_back(umfPoolMalloc(pool, 3000));
+    ptrs.push_back(umfPoolMalloc(pool, 3 * config.MaxPoolableSize));
+
+    umf_disjoint_pool_stats_t stats;
+    ASSERT_EQ(umfDisjointPoolGetStats(pool, &stats), UMF_RESULT_SUCCESS);
+    ASSERT_EQ(stats.AllocCount, 12);
+    ASSERT_EQ(stats.FreeCount, 0);
+    ASSERT_EQ(stats.SlabsInUse, 3);
+    ASSERT_EQ(stats.SlabsInPool, 0);
+    ASSERT_EQ(stats.LargeAllocCount, 1);
+    ASSERT_EQ(stats.ProviderAllocatedSize, providerSize);
+
+    for (auto *ptr : ptrs) {
+        ASSERT_EQ(umfPoolFree(pool, ptr), UMF_RESULT_SUCCESS);
+    }
+
+    ASSERT_EQ(umfDisjointPoolGetStats(pool, &stats), UMF_RESULT_SUCCESS);
+    ASSERT_EQ(stats.FreeCount, 12);
+    ASSERT_EQ(stats.SlabsInUse, 0);
+    ASSERT_EQ(stats.SlabsInPool, 3);
+    ASSERT_EQ(stats.LargeFreeCount, 1);
+    ASSERT_EQ(stats.ProviderAllocatedSize, providerSize);
+
+    umf_disjoint_pool_bucket_stats_t bucketStats;
+    size_t chunkAllocs = 0;
+    for (size_t i = 0; i < stats.NumBuckets; i++) {
+        ASSERT_EQ(umfDisjointPoolGetBucketStats(pool, i, &bucketStats),
+                  UMF_RESULT_SUCCESS);
+        if (bucketStats.BucketSize == 64) {
+            chunkAllocs = bucketStats.AllocCount;
+            ASSERT_EQ(bucketStats.MaxSlabsInUse, 1);
+        }
+    }
+    ASSERT_EQ(chunkAllocs, 10);
+
+    ASSERT_EQ(umfDisjointPoolGetBucketStats(pool, stats.NumBuckets,
+                                            &bucketStats),
+              UMF_RESULT_ERROR_INVALID_ARGUMENT);
+    ASSERT_EQ(umfDisjointPoolGetStats(nullptr, &stats),
+              UMF_RESULT_ERROR_INVALID_ARGUMENT);
+}
+
+TEST_F(test, remoteFreeQueues) {
+    providerCalls.reset();
+    auto ops = umf::providerMakeCOps<counting_provider, void>();
+    auto provider = wrapProviderUnique(createProviderChecked(&ops, nullptr));
+
+    auto config = poolConfig();
+    config.RemoteFreeQueues = 1;
+    umf_memory_pool_handle_t pool = NULL;
+    auto ret = umfPoolCreate(umfDisjointPoolOps(), provider.get(),
+                             (void *)&config, 0, &pool);
+    ASSERT_EQ(ret, UMF_RESULT_SUCCESS);
+    auto poolHandle = umf_test::wrapPoolUnique(pool);
+
+    static constexpr size_t chunkSize = 64;
+    size_t numChunks = config.SlabMinSize / chunkSize;
+
+    // Fill a slab and free all of its chunks from another thread
+    std::vector<void *> ptrs;
+    for (size_t i = 0; i < numChunks; i++) {
+        ptrs.push_back(umfPoolMalloc(pool, chunkSize));
+        ASSERT_NE(ptrs.back(), nullptr);
+    }
+    ASSERT_EQ(providerCalls.allocs, 1);
+
+    std::thread([&] {
+        for (auto *ptr : ptrs) {
+            ASSERT_EQ(umfPoolFree(pool, ptr), UMF_RESULT_SUCCESS);
+        }
+    }).join();
+
+    // The chunks are only reclaimed by the next allocation
+    umf_disjoint_pool_stats_t stats;
+    ASSERT_EQ(umfDisjointPoolGetStats(pool, &stats), UMF_RESULT_SUCCESS);
+    ASSERT_EQ(stats.SlabsInUse, 1);
+
+    void *ptr = umfPoolMalloc(pool, chunkSize);
+    ASSERT_NE(ptr, nullptr);
+    ASSERT_EQ(providerCalls.allocs, 1);
+    ASSERT_EQ(umfPoolFree(pool, ptr), UMF_RESULT_SUCCESS);
+
+    ASSERT_EQ(umfDisjointPoolGetStats(pool, &stats), UMF_RESULT_SUCCESS);
+    ASSERT_EQ(stats.SlabsInUse, 0);
+    ASSERT_EQ(stats.SlabsInPool, 1);
+    ASSERT_EQ(providerCalls.frees, 0);
+
+    // Producer and consumer threads
+    static constexpr size_t numIters = 100000;
+    std::vector<std::atomic<void *>> queue(256);
+    std::thread consumer([&] {
+        for (size_t i = 0; i < numIters; i++) {
+            void *p;
+            while (!(p = queue[i % queue.size()].exchange(nullptr))) {
+                std::this_thread::yield();
+            }
+            ASSERT_EQ(umfPoolFree(pool, p), UMF_RESULT_SUCCESS);
+        }
+    });
+    for (size_t i = 0; i < numIters; i++) {
+        void *p = umfPoolMalloc(pool, chunkSize);
+        ASSERT_NE(p, nullptr);
+        while (queue[i % queue.size()].load()) {
+            std::this_thread::yield();
+        }
+        queue[i % queue.size()].store(p);
+    }
+    consumer.join();
+}
+
+TEST_F(test, remoteFreeOfLastChunk) {
+    auto ops = umf::providerMakeCOps<umf_test::provider_malloc, void>();
+    auto provider = wrapProviderUnique(createProviderChecked(&ops, nullptr));
+
+    auto config = poolConfig();
+    config.RemoteFreeQueues = 1;
+    config.Capacity = 0;
+    umf_memory_pool_handle_t pool = NULL;
+    auto ret = umfPoolCreate(umfDisjointPoolOps(), provider.get(),
+                             (void *)&config, 0, &pool);
+    ASSERT_EQ(ret, UMF_RESULT_SUCCESS);
+    auto poolHandle = umf_test::wrapPoolUnique(pool);
+
+    static constexpr size_t chunkSize = 64;
+    static constexpr size_t numIters = 200;
+    size_t numChunks = config.SlabMinSize / chunkSize;
+
+    // Slabs emptied by another thread are freed while this thread reclaims
+    // their chunks.
+    for (size_t i = 0; i < numIters; i++) {
+        std::vector<void *> ptrs;
+        for (size_t j = 0; j < numChunks; j++) {
+            ptrs.push_back(umfPoolMalloc(pool, chunkSize));
+            ASSERT_NE(ptrs.back(), nullptr);
+        }
+
+        std::atomic<bool> done{false};
+        std::thread freer([&] {
+            for (auto *ptr : ptrs) {
+                ASSERT_EQ(umfPoolFree(pool, ptr), UMF_RESULT_SUCCESS);
+            }
+            done = true;
+        });
+        while (!done) {
+            void *ptr = umfPoolMalloc(pool, chunkSize);
+            ASSERT_NE(ptr, nullptr);
+            ASSERT_EQ(umfPoolFree(pool, ptr), UMF_RESULT_SUCCESS);
+        }
+        freer.join();
+    }
+
+    void *ptr = umfPoolMalloc(pool, chunkSize);
+    ASSERT_NE(ptr, nullptr);
+    ASSERT_EQ(umfPoolFree(pool, ptr), UMF_RESULT_SUCCESS);
+
+    umf_disjoint_pool_stats_t stats;
+    ASSERT_EQ(umfDisjointPoolGetStats(pool, &stats), UMF_RESULT_SUCCESS);
+    ASSERT_EQ(stats.SlabsInUse, 0);
+}
+
+TEST_F(test, threadOwnedSlabs) {
+    static std::atomic<size_t> numAllocs;
+    numAllocs = 0;
+
+    // Slabs are page-aligned, so that chunks of different slabs never
+    // share a cache line.
+    struct memory_provider : public umf_test::provider_malloc {
+        umf_result_t alloc(size_t size, size_t, void **ptr) noexcept {
+            numAllocs++;
+            return provider_malloc::alloc(size, 4096, ptr);
+        }
+    };
+    auto ops = umf::providerMakeCOps<memory_provider, void>();
+    auto provider = wrapProviderUnique(createProviderChecked(&ops, nullptr));
+
+    static constexpr size_t chunkSize = 16;
+    static constexpr size_t cacheLineSize = 64;
+
+    auto config = poolConfig();
+    config.MinBucketSize = chunkSize;
+    config.ThreadOwnedSlabs = 1;
+    umf_memory_pool_handle_t pool = NULL;
+    auto ret = umfPoolCreate(umfDisjointPoolOps(), provider.get(),
+                             (void *)&config, 0, &pool);
+    ASSERT_EQ(ret, UMF_RESULT_SUCCESS);
+    auto poolHandle = umf_test::wrapPoolUnique(pool);
+
+    size_t numChunks = config.SlabMinSize / chunkSize;
+
+    // Chunks allocated one after the other by different threads come from
+    // different slabs.
+    std::vector<void *> ptrs;
+    std::vector<void *> workerPtrs;
+    for (size_t i = 0; i < cacheLineSize / chunkSize - 1; i++) {
+        ptrs.push_back(umfPoolMalloc(pool, chunkSize));
+        ASSERT_NE(ptrs.back(), nullptr);
+    }
+    std::thread([&] {
+        for (size_t i = 0; i < cacheLineSize / chunkSize - 1; i++) {
+            workerPtrs.push_back(umfPoolMalloc(pool, chunkSize));
+            ASSERT_NE(workerPtrs.back(), nullptr);
+        }
+    }).join();
+    ASSERT_EQ(numAllocs, 2);
+    for (auto *ptr : ptrs) {
+        for (auto *workerPtr : workerPtrs) {
+            ASSERT_NE(reinterpret_cast<uintptr_t>(ptr) / cacheLineSize,
+                      reinterpret_cast<uintptr_t>(workerPtr) / cacheLineSize);
+        }
+    }
+
+    // Chunks of the slab of this thread freed by another thread are reused
+    // once the slab is full.
+    std::thread([&] {
+        for (auto *ptr : ptrs) {
+            ASSERT_EQ(umfPoolFree(pool, ptr), UMF_RESULT_SUCCESS);
+        }
+    }).join();
+
+    std::vector<void *> fillPtrs;
+    for (size_t i = ptrs.size(); i < numChunks; i++) {
+        fillPtrs.push_back(umfPoolMalloc(pool, chunkSize));
+        ASSERT_NE(fillPtrs.back(), nullptr);
+    }
+    ASSERT_EQ(numAllocs, 2);
+
+    void *ptr = umfPoolMalloc(pool, chunkSize);
+    ASSERT_NE(std::find(ptrs.begin(), ptrs.end(), ptr), ptrs.end());
+    ASSERT_EQ(numAllocs, 2);
+    fillPtrs.push_back(ptr);
+    for (auto *fillPtr : fillPtrs) {
+        ASSERT_EQ(umfPoolFree(pool, fillPtr), UMF_RESULT_SUCCESS);
+    }
+
+    // The slab of the worker was given back when it exited, it is pooled
+    // once its chunks are freed.
+    for (auto *workerPtr : workerPtrs) {
+        ASSERT_EQ(umfPoolFree(pool, workerPtr), UMF_RESULT_SUCCESS);
+    }
+    umf_disjoint_pool_stats_t stats;
+    ASSERT_EQ(umfDisjointPoolGetStats(pool, &stats), UMF_RESULT_SUCCESS);
+    ASSERT_EQ(stats.SlabsInPool, 1);
+
+    // Producer and consumer threads
+    static constexpr size_t numIters = 100000;
+    std::vector<std::atomic<void *>> queue(256);
+    std::thread consumer([&] {
+        for (size_t i = 0; i < numIters; i++) {
+            void *p;
+            while (!(p = queue[i % queue.size()].exchange(nullptr))) {
+                std::this_thread::yield();
+            }
+            ASSERT_EQ(umfPoolFree(pool, p), UMF_RESULT_SUCCESS);
+        }
+    });
+    for (size_t i = 0; i < numIters; i++) {
+        void *p = umfPoolMalloc(pool, chunkSize);
+        ASSERT_NE(p, nullptr);
+        while (queue[i % queue.size()].load()) {
+            std::this_thread::yield();
+        }
+        queue[i % queue.size()].store(p);
+    }
+    consumer.join();
+}
+
+TEST_F(test, threadOwnedSlabReleasedDuringRemoteFree) {
+    auto ops = umf::providerMakeCOps<umf_test::provider_malloc, void>();
+    auto provider = wrapProviderUnique(createProviderChecked(&ops, nullptr));
+
+    auto config = poolConfig();
+    config.ThreadOwnedSlabs = 1;
+    config.Capacity = 0;
+    umf_memory_pool_handle_t pool = NULL;
+    auto ret = umfPoolCreate(umfDisjointPoolOps(), provider.get(),
+                             (void *)&config, 0, &pool);
+    ASSERT_EQ(ret, UMF_RESULT_SUCCESS);
+    auto poolHandle = umf_test::wrapPoolUnique(pool);
+
+    static constexpr size_t chunkSize = 64;
+    static constexpr size_t numIters = 500;
+    size_t numChunks = config.SlabMinSize / chunkSize;
+
+    // The owner gives its slab back on exit, while another thread frees
+    // the last chunk of it.
+    for (size_t i = 0; i < numIters; i++) {
+        std::vector<void *> ptrs;
+        std::atomic<bool> ready{false};
+        std::atomic<bool> lastFree{false};
+        std::thread owner([&] {
+            for (size_t j = 0; j < numChunks; j++) {
+                ptrs.push_back(umfPoolMalloc(pool, chunkSize));
+                ASSERT_NE(ptrs.back(), nullptr);
+            }
+            ready = true;
+            while (!lastFree) {
+                std::this_thread::yield();
+            }
+        });
+        std::thread freer([&] {
+            while (!ready) {
+                std::this_thread::yield();
+            }
+            for (size_t j = 0; j < ptrs.size() - 1; j++) {
+                ASSERT_EQ(umfPoolFree(pool, ptrs[j]), UMF_RESULT_SUCCESS);
+            }
+            lastFree = true;
+            ASSERT_EQ(umfPoolFree(pool, ptrs.back()), UMF_RESULT_SUCCESS);
+        });
+        owner.join();
+        freer.join();
+    }
+
+    // Slabs left in the remote-free list are reclaimed by the next owner.
+    std::thread([&] {
+        void *ptr = umfPoolMalloc(pool, chunkSize);
+        ASSERT_NE(ptr, nullptr);
+        ASSERT_EQ(umfPoolFree(pool, ptr), UMF_RESULT_SUCCESS);
+    }).join();
+
+    umf_disjoint_pool_stats_t stats;
+    ASSERT_EQ(umfDisjointPoolGetStats(pool, &stats), UMF_RESULT_SUCCESS);
+    ASSERT_EQ(stats.SlabsInUse, 0);
+}
+
+TEST_F(test, adaptiveSlabSize) {
+    static std::vector<size_t> allocSizes;
+
+    struct memory_provider : public umf_test::provider_malloc {
+        umf_result_t alloc(size_t size, size_t align, void **ptr) noexcept {
+            allocSizes.push_back(size);
+            return provider_malloc::alloc(size, align, ptr);
+        }
+    };
+    auto ops = umf::providerMakeCOps<memory_provider, void>();
+    auto provider = wrapProviderUnique(createProviderChecked(&ops, nullptr));
+
+    auto config = poolConfig();
+    config.MaxSlabSize = 4 * config.SlabMinSize;
+    umf_memory_pool_handle_t pool = NULL;
+    auto ret = umfPoolCreate(umfDisjointPoolOps(), provider.get(),
+                             (void *)&config, 0, &pool);
+    ASSERT_EQ(ret, UMF_RESULT_SUCCESS);
+    auto poolHandle = umf_test::wrapPoolUnique(pool);
+
+    // Each time all slabs are full, the next one is twice as large
+    static constexpr size_t chunkSize = 64;
+    size_t totalSize = 0;
+    std::vector<void *> ptrs;
+    for (size_t slabSize : {config.SlabMinSize, 2 * config.SlabMinSize,
+                            4 * config.SlabMinSize, 4 * config.SlabMinSize}) {
+        allocSizes.clear();
+        for (size_t i = 0; i < slabSize / chunkSize; i++) {
+            ptrs.push_back(umfPoolMalloc(pool, chunkSize));
+            ASSERT_NE(ptrs.back(), nullptr);
+        }
+        ASSERT_EQ(allocSizes, std::vector<size_t>({slabSize}));
+
+        totalSize += slabSize;
+        auto bucketStats = getBucketStats(pool, chunkSize);
+        ASSERT_EQ(bucketStats.SlabSize, slabSize);
+        ASSERT_EQ(bucketStats.ProviderAllocatedSize, totalSize);
+    }
+
+    // Once no chunk is in use, new slabs are smaller again
+    for (auto *ptr : ptrs) {
+        ASSERT_EQ(umfPoolFree(pool, ptr), UMF_RESULT_SUCCESS);
+    }
+    ASSERT_EQ(getBucketStats(pool, chunkSize).SlabSize, 2 * config.SlabMinSize);
+}
+
+TEST_F(test, providerCallsOutsideBucketLock) {
+    static umf_memory_pool_handle_t pool = NULL;
+    static void *freedInAlloc = nullptr;
+
+    // Frees a chunk of the same bucket from another thread while a new slab
+    // is allocated, which would deadlock if the bucket was locked meanwhile.
+    struct memory_provider : public umf_test::provider_malloc {
+        umf_result_t alloc(size_t size, size_t align, void **ptr) noexcept {
+            if (freedInAlloc) {
+                std::thread([] { umfPoolFree(pool, freedInAlloc); }).join();
+                freedInAlloc = nullptr;
+            }
+            return provider_malloc::alloc(size, align, ptr);
+        }
+    };
+    auto ops = umf::providerMakeCOps<memory_provider, void>();
+    auto provider = wrapProviderUnique(createProviderChecked(&ops, nullptr));
+
+    auto config = poolConfig();
+    auto ret = umfPoolCreate(umfDisjointPoolOps(), provider.get(),
+                             (void *)&config, 0, &pool);
+    ASSERT_EQ(ret, UMF_RESULT_SUCCESS);
+    auto poolHandle = umf_test::wrapPoolUnique(pool);
+
+    // Fill a slab, the next allocation needs a new one
+    static constexpr size_t chunkSize = 64;
+    std::vector<void *> ptrs;
+    for (size_t i = 0; i < config.SlabMinSize / chunkSize; i++) {
+        ptrs.push_back(umfPoolMalloc(pool, chunkSize));
+        ASSERT_NE(ptrs.back(), nullptr);
+    }
+
+    freedInAlloc = ptrs.back();
+    ptrs.pop_back();
+    ptrs.push_back(umfPoolMalloc(pool, chunkSize));
+    ASSERT_NE(ptrs.back(), nullptr);
+    ASSERT_EQ(freedInAlloc, nullptr);
+
+    for (auto *ptr : ptrs) {
+        ASSERT_EQ(umfPoolFree(pool, ptr), UMF_RESULT_SUCCESS);
+    }
+}
+
+TEST_F(test, alignedSlabs) {
+    auto config = poolConfig();
+    config.SlabMinSize = 64 * 1024;
+    config.MaxPoolableSize = 4 * 1024 * 1024;
+
+    auto provider = wrapProviderUnique(
+        createProviderChecked(&MALLOC_PROVIDER_OPS, nullptr));
+
+    umf_memory_pool_handle_t pool = NULL;
+    auto ret = umfPoolCreate(umfDisjointPoolOps(), provider.get(),
+                             (void *)&config, 0, &pool);
+    ASSERT_EQ(ret, UMF_RESULT_SUCCESS);
+    auto poolHandle = umf_test::wrapPoolUnique(pool);
+
+    for (size_t size : {config.SlabMinSize, (size_t)2 * 1024 * 1024}) {
+        // The slab itself is aligned, so it is not larger than the allocation
+        auto *ptr = umfPoolAlignedMalloc(pool, size, size);
+        ASSERT_NE(ptr, nullptr);
+        ASSERT_EQ(reinterpret_cast<uintptr_t>(ptr) % size, 0);
+        ASSERT_EQ(umfPoolMallocUsableSize(pool, ptr), size);
+        ASSERT_EQ(umfPoolFree(pool, ptr), UMF_RESULT_SUCCESS);
+
+        // The pooled slab is reused for the next aligned allocation
+        auto *newPtr = umfPoolAlignedMalloc(pool, size, size);
+        ASSERT_EQ(newPtr, ptr);
+        ASSERT_EQ(umfPoolFree(pool, newPtr), UMF_RESULT_SUCCESS);
+    }
+}
+
+TEST_F(test, reallocLargeSplit) {
+    static constexpr size_t pageSize = paged_provider::pageSize;
+    providerCalls.reset();
+
+    auto ops = pagedProviderOps();
+    auto provider = wrapProviderUnique(createProviderChecked(&ops, nullptr));
+
+    auto config = poolConfig();
+    umf_memory_pool_handle_t pool = NULL;
+    auto ret = umfPoolCreate(umfDisjointPoolOps(), provider.get(),
+                             (void *)&config, 0, &pool);
+    ASSERT_EQ(ret, UMF_RESULT_SUCCESS);
+    auto poolHandle = umf_test::wrapPoolUnique(pool);
+
+    auto *ptr = static_cast<char *>(umfPoolMalloc(pool, 8 * pageSize));
+    ASSERT_NE(ptr, nullptr);
+    memset(ptr, 1, 8 * pageSize);
+
+    // The tail is split off and returned to the provider
+    ASSERT_EQ(umfPoolRealloc(pool, ptr, 2 * pageSize), ptr);
+    ASSERT_EQ(providerCalls.splits, 1);
+
+    // Growing allocations move with a single provider allocation, even if
+    // the pages after them happen to be free
+    providerCalls.allocs = 0;
+    auto *newPtr = static_cast<char *>(umfPoolRealloc(pool, ptr, 4 * pageSize));
+    ASSERT_NE(newPtr, nullptr);
+    ASSERT_NE(newPtr, ptr);
+    ASSERT_EQ(providerCalls.allocs, 1);
+    ASSERT_EQ(providerCalls.merges, 0);
+    for (size_t i = 0; i < 2 * pageSize; i++) {
+        ASSERT_EQ(newPtr[i], 1);
+    }
+
+    // Small enough allocations move to the pool
+    ptr = static_cast<char *>(umfPoolRealloc(pool, newPtr, 64));
+    ASSERT_NE(ptr, nullptr);
+    ASSERT_NE(ptr, newPtr);
+    for (size_t i = 0; i < 64; i++) {
+        ASSERT_EQ(ptr[i], 1);
+    }
+
+    ASSERT_EQ(umfPoolFree(pool, ptr), UMF_RESULT_SUCCESS);
+}
+
+TEST_F(test, largeAllocCache) {
+    static constexpr size_t pageSize = paged_provider::pageSize;
+    providerCalls.reset();
+
+    auto ops = pagedProviderOps();
+    auto provider = wrapProviderUnique(createProviderChecked(&ops, nullptr));
+
+    auto config = poolConfig();
+    config.LargeCacheSize = 16 * pageSize;
+    umf_memory_pool_handle_t pool = NULL;
+    auto ret = umfPoolCreate(umfDisjointPoolOps(), provider.get(),
+                             (void *)&config, 0, &pool);
+    ASSERT_EQ(ret, UMF_RESULT_SUCCESS);
+    auto poolHandle = umf_test::wrapPoolUnique(pool);
+
+    // A freed allocation is kept and reused by the next one of its size
+    auto *ptr = static_cast<char *>(umfPoolMalloc(pool, 8 * pageSize));
+    ASSERT_NE(ptr, nullptr);
+    ASSERT_EQ(umfPoolFree(pool, ptr), UMF_RESULT_SUCCESS);
+    ASSERT_EQ(getPoolStats(pool).LargeCachedSize, 8 * pageSize);
+    ASSERT_EQ(umfPoolMalloc(pool, 8 * pageSize), ptr);
+    ASSERT_EQ(getPoolStats(pool).LargeCachedSize, 0);
+
+    // A smaller allocation takes a part of it, the rest stays in the cache
+    ASSERT_EQ(umfPoolFree(pool, ptr), UMF_RESULT_SUCCESS);
+    auto *head = umfPoolMalloc(pool, 2 * pageSize);
+    ASSERT_EQ(head, ptr);
+    ASSERT_EQ(providerCalls.splits, 1);
+    ASSERT_EQ(getPoolStats(pool).LargeCachedSize, 6 * pageSize);
+    auto *tail = umfPoolMalloc(pool, 6 * pageSize);
+    ASSERT_EQ(tail, ptr + 2 * pageSize);
+    ASSERT_EQ(providerCalls.allocs, 1);
+    ASSERT_EQ(getPoolStats(pool).LargeCacheHitCount, 3);
+
+    // The least recently freed allocations are evicted above the budget
+    ASSERT_EQ(umfPoolFree(pool, head), UMF_RESULT_SUCCESS);
+    ASSERT_EQ(umfPoolFree(pool, tail), UMF_RESULT_SUCCESS);
+    ptr = static_cast<char *>(umfPoolMalloc(pool, 12 * pageSize));
+    ASSERT_NE(ptr, nullptr);
+    ASSERT_EQ(providerCalls.allocs, 2);
+    ASSERT_EQ(umfPoolFree(pool, ptr), UMF_RESULT_SUCCESS);
+    ASSERT_EQ(getPoolStats(pool).LargeCachedSize, 12 * pageSize);
+    ASSERT_EQ(providerCalls.frees, 2);
+    ASSERT_EQ(getPoolStats(pool).ProviderAllocatedSize, 12 * pageSize);
+
+    // Cached allocations are returned to the provider with the pool
+    poolHandle.reset();
+    ASSERT_EQ(providerCalls.frees, 3);
+}
+
+TEST_F(test, largeAllocCacheFull) {
+    providerCalls.reset();
+    auto ops = umf::providerMakeCOps<counting_provider, void>();
+    auto provider = wrapProviderUnique(createProviderChecked(&ops, nullptr));
+
+    // Up to 128 allocations are cached, the ones freed after that go back
+    // to the provider even within the budget.
+    static constexpr size_t maxCached = 128;
+    static constexpr size_t numAllocs = maxCached + 16;
+    auto config = poolConfig();
+    size_t size = 2 * config.MaxPoolableSize;
+    config.LargeCacheSize = numAllocs * size;
+    umf_memory_pool_handle_t pool = NULL;
+    auto ret = umfPoolCreate(umfDisjointPoolOps(), provider.get(),
+                             (void *)&config, 0, &pool);
+    ASSERT_EQ(ret, UMF_RESULT_SUCCESS);
+    auto poolHandle = umf_test::wrapPoolUnique(pool);
+
+    std::vector<void *> ptrs;
+    for (size_t i = 0; i < numAllocs; i++) {
+        ptrs.push_back(umfPoolMalloc(pool, size));
+        ASSERT_NE(ptrs.back(), nullptr);
+    }
+    for (auto *ptr : ptrs) {
+        ASSERT_EQ(umfPoolFree(pool, ptr), UMF_RESULT_SUCCESS);
+    }
+    ASSERT_EQ(getPoolStats(pool).LargeCachedSize, maxCached * size);
+    ASSERT_EQ(providerCalls.frees, numAllocs - maxCached);
+
+    // The slots of reused allocations are available again
+    auto *ptr = umfPoolMalloc(pool, size);
+    ASSERT_NE(ptr, nullptr);
+    ASSERT_EQ(providerCalls.allocs, numAllocs);
+    ASSERT_EQ(umfPoolFree(pool, ptr), UMF_RESULT_SUCCESS);
+    ASSERT_EQ(getPoolStats(pool).LargeCachedSize, maxCached * size);
+    ASSERT_EQ(providerCalls.frees, numAllocs - maxCached);
+
+    poolHandle.reset();
+    ASSERT_EQ(providerCalls.frees, numAllocs);
+}
+
+TEST_F(test, slabRefill) {
+    static constexpr size_t pageSize = paged_provider::pageSize;
+    providerCalls.reset();
+
+    auto ops = pagedProviderOps();
+    auto provider = wrapProviderUnique(createProviderChecked(&ops, nullptr));
+
+    auto config = poolConfig();
+    config.SlabRefillCount = 4;
+    umf_memory_pool_handle_t pool = NULL;
+    auto ret = umfPoolCreate(umfDisjointPoolOps(), provider.get(),
+                             (void *)&config, 0, &pool);
+    ASSERT_EQ(ret, UMF_RESULT_SUCCESS);
+    auto poolHandle = umf_test::wrapPoolUnique(pool);
+
+    // The first allocation of a full slab bucket gets the slabs for the
+    // following ones from a single provider allocation.
+    std::vector<char *> ptrs;
+    for (size_t i = 0; i < config.Capacity; i++) {
+        ptrs.push_back(static_cast<char *>(umfPoolMalloc(pool, pageSize)));
+        ASSERT_NE(ptrs.back(), nullptr);
+        ASSERT_EQ(providerCalls.allocs, 1);
+        ASSERT_EQ(getPoolStats(pool).SlabsInPool, config.Capacity - 1 - i);
+    }
+    ASSERT_EQ(providerCalls.splits, config.Capacity - 1);
+
+    std::sort(ptrs.begin(), ptrs.end());
+    for (size_t i = 0; i < ptrs.size(); i++) {
+        ASSERT_EQ(ptrs[i], ptrs[0] + i * pageSize);
+    }
+    for (auto *ptr : ptrs) {
+        ASSERT_EQ(umfPoolFree(pool, ptr), UMF_RESULT_SUCCESS);
+    }
+    ASSERT_EQ(getPoolStats(pool).SlabsInPool, config.Capacity);
+
+    // Buckets of chunks keep a single slab in the pool, so they get one
+    // slab to use and one for the pool.
+    providerCalls.allocs = providerCalls.splits = 0;
+    size_t chunksPerSlab = config.SlabMinSize / config.MinBucketSize;
+    ptrs.clear();
+    for (size_t i = 0; i < 2 * chunksPerSlab; i++) {
+        ptrs.push_back(
+            static_cast<char *>(umfPoolMalloc(pool, config.MinBucketSize)));
+        ASSERT_NE(ptrs.back(), nullptr);
+    }
+    ASSERT_EQ(providerCalls.allocs, 1);
+    ASSERT_EQ(providerCalls.splits, 1);
+    for (auto *ptr : ptrs) {
+        ASSERT_EQ(umfPoolFree(pool, ptr), UMF_RESULT_SUCCESS);
+    }
+}
+
+TEST_F(test, reuseLargerSlabs) {
+    static constexpr size_t pageSize = paged_provider::pageSize;
+    providerCalls.reset();
+
+    auto ops = pagedProviderOps();
+    auto provider = wrapProviderUnique(createProviderChecked(&ops, nullptr));
+
+    auto config = poolConfig();
+    config.MaxPoolableSize = 16 * pageSize;
+    config.ReuseLargerSlabs = 1;
+
+    auto createPool = [&]() {
+        umf_memory_pool_handle_t pool = NULL;
+        auto ret = umfPoolCreate(umfDisjointPoolOps(), provider.get(),
+                                 (void *)&config, 0, &pool);
+        EXPECT_EQ(ret, UMF_RESULT_SUCCESS);
+        return umf_test::wrapPoolUnique(pool);
+    };
+
+    // A pooled slab of a larger bucket is split, its excess goes to the
+    // pool of the bucket which fits it.
+    {
+        auto poolHandle = createPool();
+        auto pool = poolHandle.get();
+
+        auto *ptr32k = static_cast<char *>(umfPoolMalloc(pool, 8 * pageSize));
+        ASSERT_NE(ptr32k, nullptr);
+        ASSERT_EQ(umfPoolFree(pool, ptr32k), UMF_RESULT_SUCCESS);
+        ASSERT_EQ(providerCalls.allocs, 1);
+
+        auto *ptr8k = umfPoolMalloc(pool, 2 * pageSize);
+        ASSERT_EQ(ptr8k, ptr32k);
+        ASSERT_EQ(providerCalls.splits, 1);
+        ASSERT_EQ(getPoolStats(pool).SlabsInPool, 1);
+
+        // The 24k excess is split again, for a 16k slab and an 8k one.
+        auto *ptr16k = umfPoolMalloc(pool, 4 * pageSize);
+        ASSERT_EQ(ptr16k, ptr32k + 2 * pageSize);
+        ASSERT_EQ(providerCalls.splits, 2);
+        ASSERT_EQ(getPoolStats(pool).SlabsInPool, 1);
+        ASSERT_EQ(providerCalls.allocs, 1);
+
+        auto *ptr8kTail = umfPoolMalloc(pool, 2 * pageSize);
+        ASSERT_EQ(ptr8kTail, ptr32k + 6 * pageSize);
+        ASSERT_EQ(getPoolStats(pool).SlabsInPool, 0);
+        ASSERT_EQ(providerCalls.allocs, 1);
+
+        ASSERT_EQ(umfPoolFree(pool, ptr8k), UMF_RESULT_SUCCESS);
+        ASSERT_EQ(umfPoolFree(pool, ptr16k), UMF_RESULT_SUCCESS);
+        ASSERT_EQ(umfPoolFree(pool, ptr8kTail), UMF_RESULT_SUCCESS);
+    }
+
+    // Adjacent pooled slabs of a smaller bucket are merged.
+    providerCalls.allocs = providerCalls.splits = 0;
+    config.SlabRefillCount = 4;
+    {
+        auto poolHandle = createPool();
+        auto pool = poolHandle.get();
+
+        auto *ptr4k = static_cast<char *>(umfPoolMalloc(pool, pageSize));
+        ASSERT_NE(ptr4k, nullptr);
+        ASSERT_EQ(providerCalls.allocs, 1);
+        ASSERT_EQ(getPoolStats(pool).SlabsInPool, 3);
+
+        auto *ptr8k = umfPoolMalloc(pool, 2 * pageSize);
+        ASSERT_EQ(ptr8k, ptr4k + pageSize);
+        ASSERT_EQ(providerCalls.merges, 1);
+        ASSERT_EQ(getPoolStats(pool).SlabsInPool, 1);
+        ASSERT_EQ(providerCalls.allocs, 1);
+
+        ASSERT_EQ(umfPoolFree(pool, ptr4k), UMF_RESULT_SUCCESS);
+        ASSERT_EQ(umfPoolFree(pool, ptr8k), UMF_RESULT_SUCCESS);
+    }
+
+    // Slabs merged before a merge fails go back to the pool as slabs of
+    // their own size.
+    providerCalls.allocs = providerCalls.merges = 0;
+    providerCalls.failedMerge = 2;
+    {
+        auto poolHandle = createPool();
+        auto pool = poolHandle.get();
+
+        auto *ptr4k = umfPoolMalloc(pool, pageSize);
+        ASSERT_NE(ptr4k, nullptr);
+        ASSERT_EQ(getPoolStats(pool).SlabsInPool, 3);
+
+        auto *ptr12k = umfPoolMalloc(pool, 3 * pageSize);
+        ASSERT_NE(ptr12k, nullptr);
+        ASSERT_EQ(providerCalls.merges, 2);
+        ASSERT_EQ(providerCalls.allocs, 2);
+
+        std::vector<void *> ptrs;
+        for (int i = 0; i < 3; i++) {
+            auto *ptr = umfPoolMalloc(pool, pageSize);
+            ASSERT_NE(ptr, nullptr);
+            ASSERT_EQ(umfPoolMallocUsableSize(pool, ptr), pageSize);
+            ptrs.push_back(ptr);
+        }
+        ASSERT_EQ(providerCalls.allocs, 2);
+
+        // Only the slabs refilled for the larger bucket are left.
+        ASSERT_EQ(getPoolStats(pool).SlabsInPool, 3);
+
+        for (auto *ptr : ptrs) {
+            ASSERT_EQ(umfPoolFree(pool, ptr), UMF_RESULT_SUCCESS);
+        }
+        ASSERT_EQ(umfPoolFree(pool, ptr4k), UMF_RESULT_SUCCESS);
+        ASSERT_EQ(umfPoolFree(pool, ptr12k), UMF_RESULT_SUCCESS);
+    }
+}
+
+TEST_F(test, callocZeroesOnlyUsedMemory) {
+    static constexpr char pattern = (char)0xAB;
+
+    // Returns memory filled with a pattern, so that it is visible whether
+    // the pool zeroed it or not.
+    struct memory_provider : public umf_test::provider_malloc {
+        umf_result_t alloc(size_t size, size_t align, void **ptr) noexcept {
+            auto ret = provider_malloc::alloc(size, align, ptr);
+            if (ret == UMF_RESULT_SUCCESS) {
+                memset(*ptr, pattern, size);
+            }
+            return ret;
+        }
+    };
+    auto ops = umf::providerMakeCOps<memory_provider, void>();
+
+    auto isFilledWith = [](void *ptr, size_t size, char value) {
+        auto *bytes = static_cast<char *>(ptr);
+        return std::all_of(bytes, bytes + size,
+                           [value](char byte) { return byte == value; });
+    };
+
+    for (int providerMemoryZeroed : {0, 1}) {
+        auto provider =
+            wrapProviderUnique(createProviderChecked(&ops, nullptr));
+
+        auto config = poolConfig();
+        config.ProviderMemoryZeroed = providerMemoryZeroed;
+        umf_memory_pool_handle_t pool = NULL;
+        auto ret = umfPoolCreate(umfDisjointPoolOps(), provider.get(),
+                                 (void *)&config, 0, &pool);
+        ASSERT_EQ(ret, UMF_RESULT_SUCCESS);
+        auto poolHandle = umf_test::wrapPoolUnique(pool);
+
+        // Chunks, full slabs and provider allocations (zeroed with
+        // non-temporal stores because of their size)
+        for (size_t size : {(size_t)64, (size_t)3000, ((size_t)2 << 20) + 13}) {
+            auto *ptr = umfPoolCalloc(pool, 1, size);
+            ASSERT_NE(ptr, nullptr);
+            // Memory that has never been used is zeroed only if the provider
+            // does not guarantee it
+            ASSERT_TRUE(isFilledWith(ptr, size,
+                                     providerMemoryZeroed ? pattern : 0));
+
+            memset(ptr, 1, size);
+            ASSERT_EQ(umfPoolFree(pool, ptr), UMF_RESULT_SUCCESS);
+
+            // Memory reused from the pool is always zeroed
+            ptr = umfPoolCalloc(pool, 1, size);
+            ASSERT_NE(ptr, nullptr);
+            if (size < config.MaxPoolableSize) {
+                ASSERT_TRUE(isFilledWith(ptr, size, 0));
+            }
+            ASSERT_EQ(umfPoolFree(pool, ptr), UMF_RESULT_SUCCESS);
+        }
+    }
+}
+
+TEST_F(test, pooledSlabsDecay) {
+    static std::atomic<size_t> numPurges;
+
+    struct memory_provider : public counting_provider {
+        umf_result_t purge_lazy(void *, size_t) noexcept {
+            numPurges++;
+            return UMF_RESULT_SUCCESS;
+        }
+    };
+    auto ops = umf::providerMakeCOps<memory_provider, void>();
+
+    auto createPool = [&](umf_disjoint_pool_params_t &config) {
+        providerCalls.reset();
+        numPurges = 0;
+        umf_memory_pool_handle_t pool = NULL;
+        auto provider = createProviderChecked(&ops, nullptr);
+        auto ret = umfPoolCreate(umfDisjointPoolOps(), provider, &config,
+                                 UMF_POOL_CREATE_FLAG_OWN_PROVIDER, &pool);
+        EXPECT_EQ(ret, UMF_RESULT_SUCCESS);
+        return umf_test::wrapPoolUnique(pool);
+    };
+
+    // Pooled slabs are freed by the allocation path
+    {
+        auto config = poolConfig();
+        config.FreeDecayMs = 10;
+        auto pool = createPool(config);
+
+        void *ptr = umfPoolMalloc(pool.get(), 3000);
+        ASSERT_NE(ptr, nullptr);
+        ASSERT_EQ(umfPoolFree(pool.get(), ptr), UMF_RESULT_SUCCESS);
+        ASSERT_EQ(providerCalls.frees, 0);
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        for (int i = 0; i < 1024; i++) {
+            ptr = umfPoolMalloc(pool.get(), 64);
+            ASSERT_NE(ptr, nullptr);
+            ASSERT_EQ(umfPoolFree(pool.get(), ptr), UMF_RESULT_SUCCESS);
+        }
+        ASSERT_GE(providerCalls.frees, 1);
+    }
+
+    // Pooled slabs are purged by the background thread and reused
+    {
+        auto config = poolConfig();
+        config.PurgeDecayMs = 10;
+        config.DecayBackgroundThread = 1;
+        auto pool = createPool(config);
+
+        void *ptr = umfPoolMalloc(pool.get(), 3000);
+        ASSERT_NE(ptr, nullptr);
+        ASSERT_EQ(umfPoolFree(pool.get(), ptr), UMF_RESULT_SUCCESS);
+
+        for (int i = 0; i < 1000 && numPurges == 0; i++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        ASSERT_EQ(numPurges, 1);
+
+        ptr = umfPoolMalloc(pool.get(), 3000);
+        ASSERT_NE(ptr, nullptr);
+        ASSERT_EQ(providerCalls.allocs, 1);
+        ASSERT_EQ(providerCalls.frees, 0);
+        ASSERT_EQ(umfPoolFree(pool.get(), ptr), UMF_RESULT_SUCCESS);
+    }
+}
+
+TEST_F(test, autoTune) {
+    auto ops = umf::providerMakeCOps<umf_test::provider_malloc, void>();
+    auto provider = wrapProviderUnique(createProviderChecked(&ops, nullptr));
+
+    auto config = poolConfig();
+    config.Capacity = 1;
+    config.AutoTuneIntervalMs = 1;
+    umf_memory_pool_handle_t pool = NULL;
+    auto ret = umfPoolCreate(umfDisjointPoolOps(), provider.get(),
+                             (void *)&config, 0, &pool);
+    ASSERT_EQ(ret, UMF_RESULT_SUCCESS);
+    auto poolHandle = umf_test::wrapPoolUnique(pool);
+
+    // Repeat allocations of the given size, freed in batches of count, until
+    // done returns true. The tuning happens every few hundred allocations.
+    auto repeatUntil = [&](size_t size, size_t count, auto &&done) {
+        auto deadline =
+            std::chrono::steady_clock::now() + std::chrono::seconds(10);
+        std::vector<void *> ptrs(count);
+        while (!done()) {
+            if (std::chrono::steady_clock::now() > deadline) {
+                return false;
+            }
+            for (size_t round = 0; round < 64; round++) {
+                for (auto &ptr : ptrs) {
+                    ptr = umfPoolMalloc(pool, size);
+                    EXPECT_NE(ptr, nullptr);
+                }
+                for (auto *ptr : ptrs) {
+                    EXPECT_EQ(umfPoolFree(pool, ptr), UMF_RESULT_SUCCESS);
+                }
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return true;
+    };
+
+    // Slabs in use at the same time are pooled once they miss the pool
+    size_t slabSize = config.MaxPoolableSize;
+    ASSERT_EQ(getBucketStats(pool, slabSize).Capacity, 1);
+    ASSERT_TRUE(repeatUntil(slabSize, 4, [&] {
+        return getBucketStats(pool, slabSize).Capacity >= 4;
+    }));
+    ASSERT_EQ(getBucketStats(pool, slabSize).Capacity, 4);
+
+    // Frequent allocations just above MaxPoolableSize get pooled
+    ASSERT_EQ(getPoolStats(pool).MaxPoolableSize, config.MaxPoolableSize);
+    ASSERT_TRUE(repeatUntil(2 * slabSize, 1, [&] {
+        return getPoolStats(pool).MaxPoolableSize > config.MaxPoolableSize;
+    }));
+    ASSERT_EQ(getPoolStats(pool).MaxPoolableSize, 2 * slabSize);
+    ASSERT_TRUE(repeatUntil(2 * slabSize, 1, [&] {
+        return getBucketStats(pool, 2 * slabSize).AllocPoolCount > 0;
+    }));
+
+    // Both go back to the configured values once these sizes are not used
+    ASSERT_TRUE(repeatUntil(config.MinBucketSize, 1, [&] {
+        return getBucketStats(pool, slabSize).Capacity == 1 &&
+               getPoolStats(pool).MaxPoolableSize == config.MaxPoolableSize;
+    }));
+    ASSERT_LE(getBucketStats(pool, slabSize).SlabsInPool, 1);
+}
+
+#ifdef __linux__
+TEST_F(test, shardsStealPooledSlabs) {
+    cpu_set_t allowed;
+    ASSERT_EQ(sched_getaffinity(0, sizeof(allowed), &allowed), 0);
+    std::vector<int> cpus;
+    for (int cpu = 0; cpu < CPU_SETSIZE && cpus.size() < 2; cpu++) {
+        if (CPU_ISSET(cpu, &allowed)) {
+            cpus.push_back(cpu);
+        }
+    }
+    if (cpus.size() < 2) {
+        GTEST_SKIP() << "Test skipped, needs two CPUs";
+    }
+
+    providerCalls.reset();
+    auto ops = umf::providerMakeCOps<counting_provider, void>();
+    auto provider = wrapProviderUnique(createProviderChecked(&ops, nullptr));
+
+    // Each of the two CPUs has its own shard
+    auto config = poolConfig();
+    config.NumShards = cpus[1] + 1;
+    umf_memory_pool_handle_t pool = NULL;
+    auto ret = umfPoolCreate(umfDisjointPoolOps(), provider.get(),
+                             (void *)&config, 0, &pool);
+    ASSERT_EQ(ret, UMF_RESULT_SUCCESS);
+    auto poolHandle = umf_test::wrapPoolUnique(pool);
+
+    auto runOn = [](int cpu, auto &&fn) {
+        std::thread thread([&] {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpu, &set);
+            ASSERT_EQ(sched_setaffinity(0, sizeof(set), &set), 0);
+            fn();
+        });
+        thread.join();
+    };
+
+    // Slabs pooled by one shard are taken by the other one instead of
+    // allocating new ones, both whole slabs and slabs of chunks.
+    for (size_t size : {config.MaxPoolableSize, config.MinBucketSize}) {
+        void *ptr = nullptr;
+        runOn(cpus[0], [&] {
+            ptr = umfPoolMalloc(pool, size);
+            ASSERT_NE(ptr, nullptr);
+            ASSERT_EQ(umfPoolFree(pool, ptr), UMF_RESULT_SUCCESS);
+        });
+        size_t allocs = providerCalls.allocs;
+
+        runOn(cpus[1], [&] {
+            void *stolen = umfPoolMalloc(pool, size);
+            ASSERT_EQ(stolen, ptr);
+            ASSERT_EQ(umfPoolFree(pool, stolen), UMF_RESULT_SUCCESS);
+        });
+        ASSERT_EQ(providerCalls.allocs, allocs);
+    }
+
+    umf_disjoint_pool_stats_t stats;
+    ASSERT_EQ(umfDisjointPoolGetStats(pool, &stats), UMF_RESULT_SUCCESS);
+    ASSERT_EQ(stats.AllocPoolCount, 2);
+    ASSERT_EQ(stats.SlabsInPool, 2);
+}
+
+TEST_F(test, threadCacheFollowsShard) {
+    cpu_set_t allowed;
+    ASSERT_EQ(sched_getaffinity(0, sizeof(allowed), &allowed), 0);
+    std::vector<int> cpus;
+    for (int cpu = 0; cpu < CPU_SETSIZE && cpus.size() < 2; cpu++) {
+        if (CPU_ISSET(cpu, &allowed)) {
+            cpus.push_back(cpu);
+        }
+    }
+    if (cpus.size() < 2) {
+        GTEST_SKIP() << "Test skipped, needs two CPUs";
+    }
+
+    providerCalls.reset();
+    auto ops = umf::providerMakeCOps<counting_provider, void>();
+    auto provider = wrapProviderUnique(createProviderChecked(&ops, nullptr));
+
+    auto config = poolConfig();
+    config.NumShards = cpus[1] + 1;
+    config.ThreadCacheSize = 8;
+    umf_memory_pool_handle_t pool = NULL;
+    auto ret = umfPoolCreate(umfDisjointPoolOps(), provider.get(),
+                             (void *)&config, 0, &pool);
+    ASSERT_EQ(ret, UMF_RESULT_SUCCESS);
+    auto poolHandle = umf_test::wrapPoolUnique(pool);
+
+    // A thread moved to the CPU of another shard doesn't get the chunks
+    // cached from the bucket of the previous one.
+    std::thread thread([&] {
+        auto moveTo = [](int cpu) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpu, &set);
+            ASSERT_EQ(sched_setaffinity(0, sizeof(set), &set), 0);
+        };
+
+        moveTo(cpus[0]);
+        void *first = umfPoolMalloc(pool, config.MinBucketSize);
+        ASSERT_NE(first, nullptr);
+        size_t allocs = providerCalls.allocs;
+
+        moveTo(cpus[1]);
+        void *second = umfPoolMalloc(pool, config.MinBucketSize);
+        ASSERT_NE(second, nullptr);
+        ASSERT_EQ(providerCalls.allocs, allocs + 1);
+
+        ASSERT_EQ(umfPoolFree(pool, second), UMF_RESULT_SUCCESS);
+        moveTo(cpus[0]);
+        ASSERT_EQ(umfPoolFree(pool, first), UMF_RESULT_SUCCESS);
+    });
+    thread.join();
+
+    // The cached chunks went back to the slabs of their own shards
+    umf_disjoint_pool_stats_t stats;
+    ASSERT_EQ(umfDisjointPoolGetStats(pool, &stats), UMF_RESULT_SUCCESS);
+    ASSERT_EQ(stats.SlabsInUse, 0);
+    ASSERT_EQ(stats.SlabsInPool, 2);
+}
+#endif
+
+auto defaultPoolConfig = poolConfig();
+INSTANTIATE_TEST_SUITE_P(disjointPoolTests, umfPoolTest,
+                         ::testing::Values(poolCreateExtParams{
+                             umfDisjointPoolOps(), (void *)&defaultPoolConfig,
+                             &MALLOC_PROVIDER_OPS, nullptr}));
+
+INSTANTIATE_TEST_SUITE_P(
+    disjointPoolTests, umfMemTest,
+    ::testing::Values(std::make_tuple(
+        poolCreateExtParams{umfDisjointPoolOps(), (void *)&defaultPoolConfig,
+                            &MOCK_OUT_OF_MEM_PROVIDER_OPS,
+                            (void *)&defaultPoolConfig.Capacity},
+        static_cast<int>(defaultPoolConfig.Capacity) / 2)));
+
+INSTANTIATE_TEST_SUITE_P(disjointMultiPoolTests, umfMultiPoolTest,
+                         ::testing::Values(poolCreateExtParams{
+                             umfDisjointPoolOps(), (void *)&defaultPoolConfig,
+                             &MALLOC_PROVIDER_OPS, nullptr}));
+
+umf_disjoint_pool_params_t poolConfigThreadCache() {
+    umf_disjoint_pool_params_t config = poolConfig();
+    config.ThreadCacheSize = 8;
+    return config;
+}
+
+auto threadCachePoolConfig = poolConfigThreadCache();
+INSTANTIATE_TEST_SUITE_P(disjointPoolThreadCacheTests, umfPoolTest,
+                         ::testing::Values(poolCreateExtParams{
+                             umfDisjointPoolOps(),
+                             (void *)&threadCachePoolConfig,
+                             &MALLOC_PROVIDER_OPS, nullptr}));
+
+INSTANTIATE_TEST_SUITE_P(disjointThreadCacheMultiPoolTests, umfMultiPoolTest,
+                         ::testing::Values(poolCreateExtParams{
+                             umfDisjointPoolOps(),
+                             (void *)&threadCachePoolConfig,
+                             &MALLOC_PROVIDER_OPS, nullptr}));
+
+umf_disjoint_pool_params_t poolConfigPerNumaNode() {
+    umf_disjoint_pool_params_t config = poolConfig();
+    config.PerNumaNodeBuckets = 1;
+    return config;
+}
+
+auto perNumaNodePoolConfig = poolConfigPerNumaNode();
+INSTANTIATE_TEST_SUITE_P(disjointPoolPerNumaNodeTests, umfPoolTest,
+                         ::testing::Values(poolCreateExtParams{
+                             umfDisjointPoolOps(),
+                             (void *)&perNumaNodePoolConfig,
+                             &MALLOC_PROVIDER_OPS, nullptr}));
+
+umf_disjoint_pool_params_t poolConfigThreadOwnedSlabs() {
+    umf_disjoint_pool_params_t config = poolConfig();
+    config.ThreadOwnedSlabs = 1;
+    return config;
+}
+
+auto threadOwnedSlabsPoolConfig = poolConfigThreadOwnedSlabs();
+INSTANTIATE_TEST_SUITE_P(disjointPoolThreadOwnedSlabsTests, umfPoolTest,
+                         ::testing::Values(poolCreateExtParams{
+                             umfDisjointPoolOps(),
+                             (void *)&threadOwnedSlabsPoolConfig,
+                             &MALLOC_PROVIDER_OPS, nullptr}));
+
+INSTANTIATE_TEST_SUITE_P(disjointThreadOwnedSlabsMultiPoolTests,
+                         umfMultiPoolTest,
+                         ::testing::Values(poolCreateExtParams{
+                             umfDisjointPoolOps(),
+                             (void *)&threadOwnedSlabsPoolConfig,
                              &MALLOC_PROVIDER_OPS, nullptr}));